@@ -52,6 +52,53 @@ phonenumber_config_t mod_phonenumber_config;
  */
 phonenumber_hook_t *mod_phonenumber_hooks = NULL;
 
+/**
+ * Enabled hooks per phase, the state handlers return right away for a phase
+ * no hook runs in
+ */
+uint32_t mod_phonenumber_phase_hooks[PN_PHASES] = { 0 };
+
+/**
+ * Routing rules (dialplan interface)
+ *
+ * Any valid route defined in phonenumber.conf.xml will be appended to the
+ * mod_phonenumber_routes list and indexed by its key in
+ * mod_phonenumber_routes_index.
+ */
+phonenumber_route_t *mod_phonenumber_routes = NULL;
+switch_hash_t *mod_phonenumber_routes_index = NULL;
+
+/**
+ * Configuration profiles
+ *
+ * Named configurations defined in phonenumber.conf.xml, prebuilt at load
+ * time, appended to the mod_phonenumber_profiles list and indexed by name in
+ * mod_phonenumber_profiles_index. A profile is selected by the profile=<name>
+ * argument or by the value of the channel variable named by the
+ * profile_variable setting (e.g. domain_name).
+ */
+phonenumber_profile_t *mod_phonenumber_profiles = NULL;
+switch_hash_t *mod_phonenumber_profiles_index = NULL;
+char *mod_phonenumber_profile_variable = NULL;
+
+/**
+ * Translation rules (translate action)
+ *
+ * Rule sets defined in phonenumber.conf.xml, appended to the
+ * mod_phonenumber_translations list and indexed by name in
+ * mod_phonenumber_translations_index; every set indexes its rules by key,
+ * same as the routing rules.
+ */
+phonenumber_translation_t *mod_phonenumber_translations = NULL;
+switch_hash_t *mod_phonenumber_translations_index = NULL;
+
+/**
+ * Chat application actions
+ *
+ * PN_CHAT_ACTIONS, compiled once at load time.
+ */
+static phonenumber_step_t *mod_phonenumber_chat_actions = NULL;
+
 /**
  * PhoneNumberUtil singleton
  */
@@ -73,7 +120,7 @@ SWITCH_STANDARD_APP(phonenumber_app_function)
   char *number_destination = NULL;
 
   phonenumber_request_t request;
-  phonenumber_action_t *actions = NULL;
+  phonenumber_step_t *actions = NULL;
 
   switch_channel_t *channel = switch_core_session_get_channel(session);
 
@@ -113,9 +160,11 @@ SWITCH_STANDARD_APP(phonenumber_app_function)
   }
 
   if (actions) {
-    request.config = pn_util_parse_config(argv[2]);
+    request.config = pn_util_parse_config(argv[2], channel);
     request.channel = channel;
     request.stream = NULL;
+    request.event = NULL;
+    request.record = NULL;
     request.prefix = NULL;
 
     if (!zstr(number)) {
@@ -154,6 +203,139 @@ SWITCH_STANDARD_APP(phonenumber_app_function)
   switch_safe_free(mycmd);
 }
 
+/**
+ * Chat address results cleanup
+ *
+ * Drops the phonenumber_<address>_* headers a previous run may have left in
+ * the message, so they are neither duplicated nor mistaken for this run's.
+ *
+ * @param event Message
+ * @param address Address header name (from or to)
+ */
+static void pn_chat_clear(switch_event_t *event, const char *address)
+{
+  switch_event_header_t *hp;
+  char prefix[32], name[128];
+  size_t length;
+
+  switch_snprintf(prefix, sizeof(prefix), "phonenumber_%s_", address);
+  length = strlen(prefix);
+
+  do {
+    for (hp = event->headers; hp && strncmp(hp->name, prefix, length); hp = hp->next)
+      ;
+
+    if (hp) {
+      /* The header (and its name) is released by the deletion */
+      switch_copy_string(name, hp->name, sizeof(name));
+      switch_event_del_header(event, name);
+    }
+  } while (hp);
+}
+
+/**
+ * Chat address normalization
+ *
+ * Looks up the user part of one of the message's addresses (the
+ * <address>_user header, otherwise the <address> header itself, minus any
+ * sip:/tel: scheme and host) and, if it parses, rewrites both headers with
+ * the formatted number. Only E.164 fits in a URI user part, with any other
+ * format the addresses are left as they are. The region code and number type
+ * are added as phonenumber_<address>_* headers, next to the formatted number.
+ *
+ * @param request Request bound to the message
+ * @param address Address header name (from or to)
+ */
+static void pn_chat_address(phonenumber_request_t *request, const char *address)
+{
+  char header[32], user[PN_MAX_INPUT_LEN + 1], scheme[5] = "", *at;
+  const char *value, *formatted, *host = NULL;
+  char *rewritten = NULL;
+
+  switch_snprintf(header, sizeof(header), "%s_user", address);
+
+  if (zstr(value = switch_event_get_header(request->event, header)) && zstr(value = switch_event_get_header(request->event, address))) {
+    return;
+  }
+
+  if (!strncasecmp(value, "sip:", 4) || !strncasecmp(value, "tel:", 4)) {
+    value += 4;
+  }
+
+  switch_copy_string(user, value, sizeof(user));
+
+  if ((at = strchr(user, '@'))) {
+    *at = '\0';
+  }
+
+  request->number = user;
+  request->prefix = (char *)address;
+
+  pn_chat_clear(request->event, address);
+  pn_util_exec(mod_phonenumber_chat_actions, request);
+
+  switch_snprintf(user, sizeof(user), "phonenumber_%s_format", address);
+
+  if ((request->config->format != PhoneNumberUtil::E164) || zstr(formatted = switch_event_get_header(request->event, user))) {
+    return;
+  }
+
+  if ((value = switch_event_get_header(request->event, address))) {
+    if (!strncasecmp(value, "sip:", 4) || !strncasecmp(value, "tel:", 4)) {
+      switch_copy_string(scheme, value, sizeof(scheme));
+    }
+
+    host = strchr(value, '@');
+    rewritten = switch_mprintf("%s%s%s", scheme, formatted, host ? host : "");
+  }
+
+  switch_event_del_header(request->event, header);
+  switch_event_add_header_string(request->event, SWITCH_STACK_BOTTOM, header, formatted);
+
+  if (rewritten) {
+    switch_event_del_header(request->event, address);
+    switch_event_add_header_string(request->event, SWITCH_STACK_BOTTOM, address, rewritten);
+    switch_safe_free(rewritten);
+  }
+}
+
+/**
+ * Chat application interface function
+ *
+ * Implements the phonenumber chatplan application: normalizes the message's
+ * from/to addresses to the configured format (the arguments are the same as
+ * the application's, e.g. default_region=GB,format=E164) and adds region and
+ * type headers. Messages never involve a channel, the action results are
+ * written straight into the message.
+ */
+SWITCH_STANDARD_CHAT_APP(phonenumber_chat_function)
+{
+  phonenumber_request_t request;
+  char *args = NULL;
+
+  if (!zstr(data)) {
+    switch_strdup(args, data);
+  }
+
+  if (!(request.config = pn_util_parse_config(args, NULL))) {
+    switch_safe_free(args);
+    return SWITCH_STATUS_FALSE;
+  }
+
+  request.channel = NULL;
+  request.stream = NULL;
+  request.event = message;
+  request.record = NULL;
+
+  pn_chat_address(&request, PN_CHAT_FROM);
+  pn_chat_address(&request, PN_CHAT_TO);
+
+  switch_safe_free(request.config);
+  switch_safe_free(args);
+
+  return SWITCH_STATUS_SUCCESS;
+}
+
 /**
  * API interface function
  *
@@ -166,7 +348,7 @@ SWITCH_STANDARD_API(phonenumber_api_function)
   char *argv[10] = { 0 };
 
   phonenumber_request_t request;
-  phonenumber_action_t *actions = NULL;
+  phonenumber_step_t *actions = NULL;
 
   if (zstr(cmd)) {
     goto usage;
@@ -174,19 +356,75 @@ SWITCH_STANDARD_API(phonenumber_api_function)
 
   switch_strdup(mycmd, cmd);
 
-  if ((argc = switch_separate_string(mycmd, ' ', argv, (sizeof(argv) / sizeof(argv[0])))) < 2) {
+  if ((argc = switch_separate_string(mycmd, ' ', argv, (sizeof(argv) / sizeof(argv[0])))) < 1) {
+    goto usage;
+  }
+
+  if (!strcasecmp(argv[0], PN_API_TRACE)) {
+    if ((argc < 2) || strcasecmp(argv[1], PN_API_TRACE_DUMP)) {
+      goto usage;
+    }
+
+    pn_trace_dump(stream);
+    goto done;
+  }
+
+  if (!strcasecmp(argv[0], PN_API_ASYNC)) {
+    if (argc < 3) {
+      goto usage;
+    }
+
+    pn_async_submit(argv[1], argv[2], (argc >= 4) ? argv[3] : NULL, stream);
+    goto done;
+  }
+
+  if (!strcasecmp(argv[0], PN_API_CACHE)) {
+    if ((argc < 2) || strcasecmp(argv[1], PN_API_CACHE_STATS)) {
+      goto usage;
+    }
+
+    pn_cache_stats(stream);
+    goto done;
+  }
+
+  if (!strcasecmp(argv[0], PN_API_LIST)) {
+    if ((argc < 2) || strcasecmp(argv[1], PN_API_LIST_RELOAD)) {
+      goto usage;
+    }
+
+    pn_list_reload(stream);
+    goto done;
+  }
+
+  if (!strcasecmp(argv[0], PN_API_TOP)) {
+    if ((argc >= 2) && !strcasecmp(argv[1], PN_API_TOP_RESET)) {
+      pn_top_reset();
+      stream->write_function(stream, "+OK\n");
+    } else if ((argc >= 2) && switch_is_number(argv[1])) {
+      pn_top_dump(stream, phonenumber_scope::SCOPE_ALL, (uint32_t)atoi(argv[1]));
+    } else {
+      pn_top_dump(stream, pn_util_str_to_scope(argv[1]), (argc >= 3) ? (uint32_t)atoi(argv[2]) : 0);
+    }
+
+    goto done;
+  }
+
+  if (argc < 2) {
     goto usage;
   }
 
   actions = pn_util_parse_actions(argv[0]);
-  if (!actions[0]) {
+  if (pn_util_actions_empty(actions)) {
+    switch_safe_free(actions);
     goto usage;
   }
 
   request.number = argv[1];
-  request.config = pn_util_parse_config(argv[2]);
+  request.config = pn_util_parse_config(argv[2], NULL);
   request.channel = NULL;
   request.stream = stream;
+  request.event = NULL;
+  request.record = NULL;
   request.prefix = NULL;
 
   pn_util_exec(actions, &request);
@@ -196,8 +434,8 @@ SWITCH_STANDARD_API(phonenumber_api_function)
   goto done;
 
 usage:
-  switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_NOTICE, "Invalid syntax, correct usage: %s\n", PN_SYNTAX);
-  stream->write_function(stream, "-ERR: Invalid syntax, correct usage: %s\n", PN_SYNTAX);
+  switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_NOTICE, "Invalid syntax, correct usage: %s\n", PN_API_SYNTAX);
+  stream->write_function(stream, "-ERR: Invalid syntax, correct usage: %s\n", PN_API_SYNTAX);
 
 done:
   switch_safe_free(mycmd);
@@ -206,20 +444,260 @@ done:
 }
 
 /**
- * State handler
+ * Dialplan interface function
  *
- * The handler is invoked whenever a channel enters the CS_INIT state, in
- * order to power hooks defined in phonenumber.conf.xml.
+ * Implements the phonenumber dialplan: the destination number is parsed once
+ * and the extension is built out of the route matching its region code, type
+ * and validity. The dialplan argument (e.g. phonenumber:default_region=GB)
+ * is treated as a configuration string.
  */
-switch_status_t mod_phonenumber_on_init_handler(switch_core_session_t *session)
+SWITCH_STANDARD_DIALPLAN(phonenumber_dialplan_hunt)
+{
+  switch_caller_extension_t *extension = NULL;
+  switch_channel_t *channel = switch_core_session_get_channel(session);
+  phonenumber_config_t *config = NULL;
+  phonenumber_route_t *route = NULL;
+  phonenumber_route_action_t *action = NULL;
+  PhoneNumberUtil::PhoneNumberType type;
+  phonenumber_request_t request;
+  PhoneNumber parsed;
+  string region;
+  char *mycfg = NULL, matched[3];
+  int error;
+  bool valid;
+
+  if (!caller_profile && !(caller_profile = switch_channel_get_caller_profile(channel))) {
+    switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR, "Cannot obtain caller profile!\n");
+    return NULL;
+  }
+
+  if (zstr(caller_profile->destination_number)) {
+    return NULL;
+  }
+
+  if (!zstr((char *)arg)) {
+    switch_strdup(mycfg, (char *)arg);
+  }
+
+  if (!(config = pn_util_parse_config(mycfg, channel))) {
+    switch_safe_free(mycfg);
+    return NULL;
+  }
+
+  request.number = (char *)caller_profile->destination_number;
+  request.config = config;
+  request.parsed = NULL;
+  request.channel = channel;
+  request.stream = NULL;
+  request.event = NULL;
+  request.prefix = (char *)PN_DESTINATION;
+  request.capture = NULL;
+  request.record = NULL;
+
+  /* Same parse as the actions', unparsable destinations are left to the next dialplan */
+  if ((error = pn_util_parse(&request, &parsed, matched)) != PhoneNumberUtil::NO_PARSING_ERROR) {
+    pn_util_set_error(&request, error);
+    switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_INFO, "Cannot route %s (%s)\n", caller_profile->destination_number,
+                      pn_util_error_to_str(error));
+    goto done;
+  }
+
+  switch_channel_set_variable(channel, "phonenumber_destination_error", NULL);
+
+  if (config->candidates[0]) {
+    switch_channel_set_variable(channel, "phonenumber_destination_matched_region", matched[0] ? matched : PN_UNKNOWN_REGION);
+  }
+
+  phone_util.GetRegionCodeForNumber(parsed, &region);
+  type = phone_util.GetNumberType(parsed);
+
+  /* A number is valid exactly when its type can be determined, so there is no
+   * point in running the pattern matching again through IsValidNumber() */
+  valid = (type != PhoneNumberUtil::UNKNOWN);
+
+  switch_channel_set_variable(channel, "phonenumber_destination_region_code", region.c_str());
+  switch_channel_set_variable(channel, "phonenumber_destination_number_type", pn_util_type_to_str(type));
+  switch_channel_set_variable(channel, "phonenumber_destination_is_valid_number", valid ? "true" : "false");
+
+  if (!(route = pn_util_match_route(region.c_str(), pn_util_type_to_str(type), valid))) {
+    switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_INFO, "No route for %s (%s, %s, %s)\n", caller_profile->destination_number, region.c_str(),
+                      pn_util_type_to_str(type), valid ? "valid" : "invalid");
+    goto done;
+  }
+
+  switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_INFO, "Routing %s via %s\n", caller_profile->destination_number, route->key);
+
+  if (!(extension = switch_caller_extension_new(session, route->key, caller_profile->destination_number))) {
+    switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_CRIT, "Cannot create extension, possibly OOM!\n");
+    goto done;
+  }
+
+  for (action = route->actions; action; action = action->next) {
+    switch_caller_extension_add_application(session, extension, action->application, action->data);
+  }
+
+done:
+  switch_safe_free(config);
+  switch_safe_free(mycfg);
+
+  return extension;
+}
+
+/**
+ * Result propagation
+ *
+ * Copies the results recorded by a hook on another leg of the same call,
+ * provided they were computed by an identical hook (same signature) against
+ * the very same input. Only the results of that hook are copied, along with
+ * its record so the results can be propagated further.
+ *
+ * @param channel Channel to populate
+ * @param origin Channel of the originating leg
+ * @param prefix Variable prefix (caller/destination)
+ * @param number Input about to be processed
+ * @param signature Signature of the hook about to run
+ * @return Whether or not the results have been propagated
+ */
+static bool pn_propagate(switch_channel_t *channel, switch_channel_t *origin, const char *prefix, const char *number, const char *signature)
+{
+  switch_event_header_t *headers, *hi;
+  char name[PN_PROPAGATE_VARIABLE_LEN], *record = NULL, *line, *next, *eq;
+
+  if (zstr(number)) {
+    return false;
+  }
+
+  switch_snprintf(name, sizeof(name), "phonenumber_%s_" PN_PROPAGATE_VARIABLE "%s", prefix, signature);
+
+  if (!(headers = switch_channel_variable_first(origin))) {
+    return false;
+  }
+
+  for (hi = headers; hi; hi = hi->next) {
+    if (!strcmp(hi->name, name)) {
+      switch_strdup(record, hi->value);
+      break;
+    }
+  }
+
+  switch_channel_variable_last(origin);
+
+  /* First line is the input the results were computed for */
+  if (!record || !(next = strchr(record, '\n')) || ((size_t)(next - record) != strlen(number)) || strncmp(record, number, next - record)) {
+    switch_safe_free(record);
+    return false;
+  }
+
+  switch_channel_set_variable(channel, name, record);
+  switch_channel_set_variable_name_printf(channel, number, "phonenumber_%s_input", prefix);
+
+  for (line = next + 1; (next = strchr(line, '\n')); line = next + 1) {
+    *next = '\0';
+
+    if ((eq = strchr(line, '='))) {
+      *eq = '\0';
+      switch_channel_set_variable_name_printf(channel, eq + 1, "phonenumber_%s_%s", prefix, line);
+    }
+  }
+
+  switch_safe_free(record);
+
+  return true;
+}
+
+/**
+ * Hook execution
+ *
+ * Runs a hook against one of the channel's numbers, unless its results can be
+ * propagated from the originating leg; propagating hooks record their results
+ * for the legs they originate.
+ *
+ * @param hook Hook
+ * @param request Channel bound request
+ * @param origin Channel of the originating leg, if any
+ * @param signature Signature of the hook, as configured for the channel
+ */
+static void pn_hook_exec(phonenumber_hook_t *hook, phonenumber_request_t *request, switch_channel_t *origin, const char *signature)
+{
+  switch_stream_handle_t record = { 0 };
+
+  if (!hook->propagate) {
+    pn_util_exec(hook->actions, request);
+    return;
+  }
+
+  if (origin && pn_propagate(request->channel, origin, request->prefix, request->number, signature)) {
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Propagated phonenumber_%s_* from %s\n", request->prefix, switch_channel_get_name(origin));
+    return;
+  }
+
+  SWITCH_STANDARD_STREAM(record);
+  record.write_function(&record, "%s\n", request->number ? request->number : "");
+  request->record = &record;
+
+  pn_util_exec(hook->actions, request);
+
+  request->record = NULL;
+  switch_channel_set_variable_name_printf(request->channel, (char *)record.data, "phonenumber_%s_" PN_PROPAGATE_VARIABLE "%s", request->prefix, signature);
+  switch_safe_free(record.data);
+}
+
+/**
+ * Hook runner
+ *
+ * Executes the hooks defined in phonenumber.conf.xml for the given phase
+ * against the session's caller and destination numbers. Hooks whose prefix
+ * or channel variable predicates do not hold are skipped before any number
+ * is parsed.
+ *
+ * @param session Session
+ * @param phase Phase the session is going through
+ */
+static void pn_run_hooks(switch_core_session_t *session, phonenumber_phase phase)
 {
   switch_channel_t *channel = switch_core_session_get_channel(session);
   switch_caller_profile_t *profile = switch_channel_get_caller_profile(channel);
 
   phonenumber_hook_t *hook = mod_phonenumber_hooks;
+  switch_core_session_t *origin_session = NULL;
+  switch_channel_t *origin = NULL;
+  bool located = false, looked_up = false;
+  uint64_t applicable = 0;
+  phonenumber_config_t *selected = NULL;
+
+  if (!mod_phonenumber_phase_hooks[phase]) {
+    return;
+  }
 
   while (hook) {
+    if (hook->phase != phase) {
+      hook = hook->next;
+      continue;
+    }
+
+    /* Filters and profile are only looked up once a hook of this phase is found */
+    if (!looked_up) {
+      looked_up = true;
+      applicable = pn_match_hooks(channel, profile);
+      selected = pn_util_channel_profile(channel);
+    }
+
+    /* A predicate which did not compile would otherwise match everything */
+    if (hook->disabled) {
+      PN_PROBE3(hook__skip, hook->index, (int)phase, PN_HOOK_SKIP_DISABLED);
+      hook = hook->next;
+      continue;
+    }
+
+    if (hook->bit && !(applicable & hook->bit)) {
+      PN_PROBE3(hook__skip, hook->index, (int)phase, PN_HOOK_SKIP_FILTER);
+      switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Channel %s not covered by hook (prefix/variable filters)\n", switch_channel_get_name(channel));
+      hook = hook->next;
+      continue;
+    }
+
     if (hook->context && strcmp(hook->context, profile->context)) {
+      PN_PROBE3(hook__skip, hook->index, (int)phase, PN_HOOK_SKIP_CONTEXT);
       switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Context %s not covered by hook\n", profile->context);
       hook = hook->next;
       continue;
@@ -227,41 +705,68 @@ switch_status_t mod_phonenumber_on_init_handler(switch_core_session_t *session)
 
     if (hook->direction != phonenumber_direction::DIRECTION_ALL) {
       if ((profile->direction == SWITCH_CALL_DIRECTION_INBOUND) && (hook->direction != phonenumber_direction::DIRECTION_INBOUND)) {
+        PN_PROBE3(hook__skip, hook->index, (int)phase, PN_HOOK_SKIP_DIRECTION);
         switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Direction inbound not covered by hook\n");
         hook = hook->next;
         continue;
       }
 
       if ((profile->direction == SWITCH_CALL_DIRECTION_OUTBOUND) && (hook->direction != phonenumber_direction::DIRECTION_OUTBOUND)) {
+        PN_PROBE3(hook__skip, hook->index, (int)phase, PN_HOOK_SKIP_DIRECTION);
         switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Direction outbound not covered by hook\n");
         hook = hook->next;
         continue;
       }
     }
 
+    PN_PROBE3(hook__match, hook->index, (int)phase, switch_channel_get_name(channel));
+
     phonenumber_request_t request;
+    char signature[PN_SIGNATURE_LEN];
+
+    request.config = (hook->profiled && selected) ? selected : &hook->config;
 
-    request.config = &hook->config;
+    /* A hook following the channel's profile only shares results with legs
+     * on the same profile */
+    if (hook->propagate && (request.config != &hook->config)) {
+      pn_util_signature(hook->signature, request.config, signature);
+    } else {
+      switch_copy_string(signature, hook->signature, sizeof(signature));
+    }
     request.channel = channel;
     request.stream = NULL;
+    request.event = NULL;
+    request.record = NULL;
     request.prefix = NULL;
 
+    if (hook->propagate && !located) {
+      const char *uuid;
+
+      located = true;
+
+      if ((uuid = switch_channel_get_variable(channel, SWITCH_ORIGINATOR_VARIABLE)) || (uuid = switch_channel_get_variable(channel, PN_LOOPBACK_VARIABLE))) {
+        if ((origin_session = switch_core_session_locate(uuid))) {
+          origin = switch_core_session_get_channel(origin_session);
+        }
+      }
+    }
+
     if ((hook->scope == phonenumber_scope::SCOPE_ALL) || (hook->scope == phonenumber_scope::SCOPE_CALLER)) {
       request.number = (char *)profile->orig_caller_id_number;
       switch_strdup(request.prefix, PN_CALLER);
 
-      pn_util_exec(hook->actions, &request);
+      pn_hook_exec(hook, &request, origin, signature);
 
       switch_safe_free(request.prefix);
     }
 
-    request.config = &hook->config;
+    request.config = (hook->profiled && selected) ? selected : &hook->config;
 
     if ((hook->scope == phonenumber_scope::SCOPE_ALL) || (hook->scope == phonenumber_scope::SCOPE_DESTINATION)) {
       request.number = (char *)profile->destination_number;
       switch_strdup(request.prefix, PN_DESTINATION);
 
-      pn_util_exec(hook->actions, &request);
+      pn_hook_exec(hook, &request, origin, signature);
 
       switch_safe_free(request.prefix);
     }
@@ -269,6 +774,59 @@ switch_status_t mod_phonenumber_on_init_handler(switch_core_session_t *session)
     hook = hook->next;
   }
 
+  if (origin_session) {
+    switch_core_session_rwunlock(origin_session);
+  }
+}
+
+/**
+ * Init state handler
+ *
+ * The handler is invoked whenever a channel enters the CS_INIT state, in
+ * order to power hooks defined in phonenumber.conf.xml (init phase).
+ */
+switch_status_t mod_phonenumber_on_init_handler(switch_core_session_t *session)
+{
+  pn_run_hooks(session, phonenumber_phase::PHASE_INIT);
+
+  return SWITCH_STATUS_SUCCESS;
+}
+
+/**
+ * Routing state handler
+ *
+ * Powers the routing phase hooks, right before the dialplan is consulted
+ * (including after transfers).
+ */
+switch_status_t mod_phonenumber_on_routing_handler(switch_core_session_t *session)
+{
+  pn_run_hooks(session, phonenumber_phase::PHASE_ROUTING);
+
+  return SWITCH_STATUS_SUCCESS;
+}
+
+/**
+ * Reporting state handler
+ *
+ * Powers the reporting phase hooks, after hangup and off the call setup path;
+ * their results are available to the CDR modules loaded after this one.
+ */
+switch_status_t mod_phonenumber_on_reporting_handler(switch_core_session_t *session)
+{
+  pn_run_hooks(session, phonenumber_phase::PHASE_REPORTING);
+
+  return SWITCH_STATUS_SUCCESS;
+}
+
+/**
+ * Destroy state handler
+ *
+ * Releases the session memo built by hooks and applications.
+ */
+switch_status_t mod_phonenumber_on_destroy_handler(switch_core_session_t *session)
+{
+  pn_util_memo_destroy(switch_core_session_get_channel(session));
+
   return SWITCH_STATUS_SUCCESS;
 }
 
@@ -277,7 +835,7 @@ switch_status_t mod_phonenumber_on_init_handler(switch_core_session_t *session)
  */
 switch_state_handler_table_t mod_phonenumber_state_handlers = {
   /*.on_init */ mod_phonenumber_on_init_handler,
-  /*.on_routing */ NULL,
+  /*.on_routing */ mod_phonenumber_on_routing_handler,
   /*.on_execute */ NULL,
   /*.on_hangup */ NULL,
   /*.on_exchange_media */ NULL,
@@ -286,7 +844,8 @@ switch_state_handler_table_t mod_phonenumber_state_handlers = {
   /*.on_hibernate */ NULL,
   /*.on_reset */ NULL,
   /*.on_park */ NULL,
-  /*.on_reporting */ NULL
+  /*.on_reporting */ mod_phonenumber_on_reporting_handler,
+  /*.on_destroy */ mod_phonenumber_on_destroy_handler
 };
 
 /**
@@ -295,19 +854,33 @@ switch_state_handler_table_t mod_phonenumber_state_handlers = {
  * Handles module's initialization:
  * - sets up the dialplan application;
  * - sets up the API interface;
+ * - sets up the dialplan interface;
  * - configures the API autocomplete;
  * - populates the default configuration;
- * - installs the state handler (if there are defined hooks);
+ * - allocates the trace ring buffer (if enabled);
+ * - allocates the heavy hitter trackers (if enabled);
+ * - maps the lookup cache (if enabled) and warms it up from the snapshot;
+ * - loads the membership lists;
+ * - starts the asynchronous lookup workers (if enabled);
+ * - installs the state handler (hooks and session memo cleanup);
  */
 SWITCH_MODULE_LOAD_FUNCTION(mod_phonenumber_load)
 {
   switch_application_interface_t *app_interface;
   switch_api_interface_t *api_interface;
+  switch_dialplan_interface_t *dp_interface;
+  switch_chat_application_interface_t *chat_app_interface;
+  char chat_actions[] = PN_CHAT_ACTIONS;
 
   *module_interface = switch_loadable_module_create_module_interface(pool, modname);
 
   SWITCH_ADD_APP(app_interface, "phonenumber", "Look up phone number", "Look up phone number", phonenumber_app_function, PN_SYNTAX, SAF_ROUTING_EXEC | SAF_SUPPORT_NOMEDIA);
-  SWITCH_ADD_API(api_interface, "phonenumber", "phonenumber", phonenumber_api_function, PN_SYNTAX);
+  SWITCH_ADD_API(api_interface, "phonenumber", "phonenumber", phonenumber_api_function, PN_API_SYNTAX);
+  SWITCH_ADD_DIALPLAN(dp_interface, "phonenumber", phonenumber_dialplan_hunt);
+  SWITCH_ADD_CHAT_APP(chat_app_interface, "phonenumber", "Normalize message addresses", "Normalize message addresses", phonenumber_chat_function, PN_CHAT_SYNTAX,
+                      SCAF_NONE);
+
+  mod_phonenumber_chat_actions = pn_util_parse_actions(chat_actions);
 
   switch_console_set_complete("add phonenumber");
   switch_console_set_complete("add phonenumber is_alpha_number");
@@ -323,17 +896,60 @@ SWITCH_MODULE_LOAD_FUNCTION(mod_phonenumber_load)
   switch_console_set_complete("add phonenumber is_possible_number_with_reason");
   switch_console_set_complete("add phonenumber is_possible_number");
   switch_console_set_complete("add phonenumber get_description_for_number");
+  switch_console_set_complete("add phonenumber extract");
+  switch_console_set_complete("add phonenumber is_listed");
+  switch_console_set_complete("add phonenumber is_valid_number");
+  switch_console_set_complete("add phonenumber key");
+  switch_console_set_complete("add phonenumber translate");
+  switch_console_set_complete("add phonenumber trace dump");
+  switch_console_set_complete("add phonenumber top caller");
+  switch_console_set_complete("add phonenumber top destination");
+  switch_console_set_complete("add phonenumber top reset");
+  switch_console_set_complete("add phonenumber cache stats");
+  switch_console_set_complete("add phonenumber async");
+  switch_console_set_complete("add phonenumber list reload");
 
   if (pn_util_do_config() != SWITCH_STATUS_SUCCESS) {
     switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Cannot configure module!\n");
     return SWITCH_STATUS_TERM;
   }
 
-  if (mod_phonenumber_hooks) {
-    if (switch_core_add_state_handler(&mod_phonenumber_state_handlers) == -1) {
-      switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Cannot setup state hanlder!\n");
-      return SWITCH_STATUS_TERM;
-    }
+  pn_util_lengths_init();
+
+  if (pn_trace_init() != SWITCH_STATUS_SUCCESS) {
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Cannot set up tracing!\n");
+    return SWITCH_STATUS_TERM;
+  }
+
+  if (pn_top_init(pool) != SWITCH_STATUS_SUCCESS) {
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Cannot set up heavy hitter tracking!\n");
+    return SWITCH_STATUS_TERM;
+  }
+
+  if (pn_cache_init() != SWITCH_STATUS_SUCCESS) {
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Cannot set up lookup cache!\n");
+    return SWITCH_STATUS_TERM;
+  }
+
+  if (pn_snapshot_init(pool) != SWITCH_STATUS_SUCCESS) {
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Cannot set up snapshots!\n");
+    return SWITCH_STATUS_TERM;
+  }
+
+  if (pn_list_init(pool) != SWITCH_STATUS_SUCCESS) {
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Cannot set up membership lists!\n");
+    return SWITCH_STATUS_TERM;
+  }
+
+  if (pn_async_init(pool) != SWITCH_STATUS_SUCCESS) {
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Cannot set up asynchronous lookups!\n");
+    return SWITCH_STATUS_TERM;
+  }
+
+  /* Always installed, the on_destroy handler releases session memos */
+  if (switch_core_add_state_handler(&mod_phonenumber_state_handlers) == -1) {
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Cannot setup state hanlder!\n");
+    return SWITCH_STATUS_TERM;
   }
 
   return SWITCH_STATUS_SUCCESS;
@@ -344,15 +960,25 @@ SWITCH_MODULE_LOAD_FUNCTION(mod_phonenumber_load)
  *
  * Prepares the module for shutdown:
  * - removes the state handler (if installed);
- * - flushes the hook list;
+ * - flushes the hook list and its predicates;
+ * - flushes the route list and its index;
+ * - flushes the profile list and its index;
+ * - flushes the translation rule sets and their indexes;
+ * - releases the trace ring buffer;
+ * - releases the heavy hitter trackers;
+ * - releases the membership lists;
  */
 SWITCH_MODULE_SHUTDOWN_FUNCTION(mod_phonenumber_shutdown)
 {
   phonenumber_hook_t *curr = mod_phonenumber_hooks, *next = NULL;
+  phonenumber_route_t *route = mod_phonenumber_routes, *next_route = NULL;
+  phonenumber_route_action_t *action = NULL, *next_action = NULL;
 
-  if (mod_phonenumber_hooks) {
-    switch_core_remove_state_handler(&mod_phonenumber_state_handlers);
-  }
+  pn_async_destroy();
+
+  switch_safe_free(mod_phonenumber_chat_actions);
+
+  switch_core_remove_state_handler(&mod_phonenumber_state_handlers);
 
   while (curr) {
     next = curr->next;
@@ -367,6 +993,73 @@ SWITCH_MODULE_SHUTDOWN_FUNCTION(mod_phonenumber_shutdown)
     curr = next;
   }
   mod_phonenumber_hooks = NULL;
+  memset(mod_phonenumber_phase_hooks, 0, sizeof(mod_phonenumber_phase_hooks));
+
+  if (mod_phonenumber_routes_index) {
+    switch_core_hash_destroy(&mod_phonenumber_routes_index);
+  }
+
+  while (route) {
+    next_route = route->next;
+    action = route->actions;
+
+    while (action) {
+      next_action = action->next;
+      switch_safe_free(action->application);
+      switch_safe_free(action->data);
+      switch_safe_free(action);
+      action = next_action;
+    }
+
+    switch_safe_free(route->key);
+    switch_safe_free(route);
+    route = next_route;
+  }
+  mod_phonenumber_routes = NULL;
+
+  if (mod_phonenumber_profiles_index) {
+    switch_core_hash_destroy(&mod_phonenumber_profiles_index);
+  }
+
+  while (mod_phonenumber_profiles) {
+    phonenumber_profile_t *next_profile = mod_phonenumber_profiles->next;
+
+    switch_safe_free(mod_phonenumber_profiles->name);
+    switch_safe_free(mod_phonenumber_profiles);
+    mod_phonenumber_profiles = next_profile;
+  }
+
+  switch_safe_free(mod_phonenumber_profile_variable);
+
+  if (mod_phonenumber_translations_index) {
+    switch_core_hash_destroy(&mod_phonenumber_translations_index);
+  }
+
+  while (mod_phonenumber_translations) {
+    phonenumber_translation_t *next_translation = mod_phonenumber_translations->next;
+
+    while (mod_phonenumber_translations->rules) {
+      phonenumber_translation_rule_t *next_rule = mod_phonenumber_translations->rules->next;
+
+      switch_safe_free(mod_phonenumber_translations->rules);
+      mod_phonenumber_translations->rules = next_rule;
+    }
+
+    if (mod_phonenumber_translations->index) {
+      switch_core_hash_destroy(&mod_phonenumber_translations->index);
+    }
+
+    switch_safe_free(mod_phonenumber_translations->name);
+    switch_safe_free(mod_phonenumber_translations);
+    mod_phonenumber_translations = next_translation;
+  }
+
+  pn_trace_destroy();
+  pn_top_destroy();
+  pn_snapshot_destroy();
+  pn_cache_destroy();
+  pn_list_destroy();
+  pn_match_destroy();
 
   return SWITCH_STATUS_SUCCESS;
 }
@@ -25,20 +25,214 @@
 
 #include <switch.h>
 
+#include <atomic>
+
 #include "phonenumbers/phonenumberutil.h"
 
 using i18n::phonenumbers::PhoneNumber;
 using i18n::phonenumbers::PhoneNumberUtil;
 
 /**
- * Maximum actions per run
+ * Maximum actions (including guards) per run
  */
 #define PN_MAX_ACTIONS 20
 
+/**
+ * Text window scanned per PhoneNumberMatcher pass by the extract action
+ */
+#define PN_EXTRACT_CHUNK 4096
+
+/**
+ * E.164 output buffer: +, up to 3 country code digits, Italian leading zeros
+ * and up to 20 national number digits
+ */
+#define PN_E164_LEN 48
+
+/**
+ * Highest country calling code (possible length tables)
+ */
+#define PN_MAX_COUNTRY_CODE 999
+
+/**
+ * Longest national significant number (possible length tables)
+ */
+#define PN_MAX_NSN_LEN 20
+
+/**
+ * Packed number keys: country calling code (10 bits), Italian leading zeros
+ * (3 bits) and national number (51 bits), most significant first; 0 is never
+ * a valid key
+ */
+#define PN_KEY_CC_SHIFT 54
+#define PN_KEY_ZEROS_SHIFT 51
+#define PN_KEY_MAX_ZEROS 7
+#define PN_KEY_NN_MASK ((1ULL << PN_KEY_ZEROS_SHIFT) - 1)
+
+typedef uint64_t phonenumber_key_t;
+
+/**
+ * Candidate default regions (default_region=US|CA|JM), stored as given
+ */
+#define PN_MAX_REGION_CANDIDATES 8
+#define PN_REGION_CANDIDATES_LEN (PN_MAX_REGION_CANDIDATES * 3)
+#define PN_REGION_SEPARATOR '|'
+
+/**
+ * Longest input handed over to the parser (libphonenumber rejects anything
+ * longer anyway)
+ */
+#define PN_MAX_INPUT_LEN 250
+
+/**
+ * Prefilter rejection codes, numbered past PhoneNumberUtil::ErrorType
+ */
+#define PN_REJECT_EMPTY 16
+#define PN_REJECT_TOO_LONG 17
+#define PN_REJECT_NO_DIGITS 18
+#define PN_REJECT_URI 19
+#define PN_REJECT_INVALID_CHARACTERS 20
+#define PN_REJECT_SENTINEL 21
+
+/**
+ * USDT probes
+ *
+ * Static tracepoints (provider "phonenumber") compiled in when PN_USDT is
+ * defined, which the Makefile does whenever sys/sdt.h is available. Every
+ * probe is guarded by its semaphore, so neither the probe nor its arguments
+ * cost anything until a tracer (bpftrace, perf, systemtap) attaches to it:
+ *
+ *   request__start(prefix, number_len)
+ *   request__done(prefix, number_len, error)
+ *   parse__start(prefix, number_len)
+ *   parse__done(prefix, number_len, error)
+ *   action__start(prefix, action_id, number_len)
+ *   action__done(prefix, action_id, number_len)
+ *   hook__match(hook, phase, channel)
+ *   hook__skip(hook, phase, reason)
+ */
+#ifdef PN_USDT
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+#define PN_PROBE_DEFINE(name) unsigned short phonenumber_##name##_semaphore __attribute__((section(".probes"))) = 0
+#define PN_PROBE_ENABLED(name) __builtin_expect(phonenumber_##name##_semaphore, 0)
+#define PN_PROBE2(name, a, b)                          \
+  do {                                                 \
+    if (PN_PROBE_ENABLED(name)) {                      \
+      DTRACE_PROBE2(phonenumber, name, a, b);          \
+    }                                                  \
+  } while (0)
+#define PN_PROBE3(name, a, b, c)                       \
+  do {                                                 \
+    if (PN_PROBE_ENABLED(name)) {                      \
+      DTRACE_PROBE3(phonenumber, name, a, b, c);       \
+    }                                                  \
+  } while (0)
+
+extern unsigned short phonenumber_request__start_semaphore, phonenumber_request__done_semaphore;
+extern unsigned short phonenumber_parse__start_semaphore, phonenumber_parse__done_semaphore;
+extern unsigned short phonenumber_action__start_semaphore, phonenumber_action__done_semaphore;
+extern unsigned short phonenumber_hook__match_semaphore, phonenumber_hook__skip_semaphore;
+#else
+#define PN_PROBE2(name, a, b)
+#define PN_PROBE3(name, a, b, c)
+#endif
+
+#define PN_PROBE_PREFIX(request) ((request)->prefix ? (request)->prefix : "")
+#define PN_PROBE_NUMBER_LEN(request) ((request)->number ? strlen((request)->number) : 0)
+
+/**
+ * hook__skip probe reasons
+ */
+#define PN_HOOK_SKIP_FILTER 1
+#define PN_HOOK_SKIP_CONTEXT 2
+#define PN_HOOK_SKIP_DIRECTION 3
+#define PN_HOOK_SKIP_DISABLED 4
+
+/**
+ * Trace ring buffer limits
+ */
+#define PN_TRACE_MAX_SIZE 65536
+#define PN_TRACE_INPUT_LEN 48
+#define PN_TRACE_PREFIX_LEN 12
+
+/**
+ * Heavy hitter tracking (count-min sketch and top-K heap) dimensions
+ */
+#define PN_TOP_DEPTH 4
+#define PN_TOP_WIDTH 4096
+#define PN_TOP_MAX_SIZE 100
+#define PN_TOP_NUMBER_LEN 32
+
+/**
+ * Module version, normally provided by the Makefile
+ */
+#ifndef PN_VERSION
+#define PN_VERSION "unknown"
+#endif
+
+/**
+ * Shared lookup cache dimensions; every slot holds one action's result for
+ * a given (normalized input, configuration) pair.
+ */
+#define PN_CACHE_MAGIC 0x504e4331
+#define PN_CACHE_MAX_SIZE 16777216
+#define PN_CACHE_PROBE 8
+#define PN_CACHE_KEY_LEN 48
+#define PN_CACHE_SUFFIX_LEN 40
+#define PN_CACHE_VALUE_LEN 96
+#define PN_CACHE_VERSION_LEN 16
+
+/**
+ * Warm-start snapshot format
+ */
+#define PN_SNAPSHOT_MAGIC 0x504e5331
+#define PN_SNAPSHOT_DEFAULT_SIZE 10000
+#define PN_SNAPSHOT_GROUP "mod_phonenumber"
+
+/**
+ * Asynchronous lookups (worker pool and result event)
+ */
+#define PN_ASYNC_MAX_WORKERS 64
+#define PN_ASYNC_DEFAULT_QUEUE_SIZE 10000
+#define PN_EVENT_RESULT "phonenumber::result"
+
+/**
+ * Membership lists (is_listed action); entries are E.164 numbers packed as
+ * integers, screened through a Bloom filter of PN_LIST_BLOOM_BITS bits per
+ * entry probed PN_LIST_BLOOM_HASHES times.
+ */
+#define PN_LIST_NAME_LEN 32
+#define PN_LIST_MAX_DIGITS 15
+#define PN_LIST_BLOOM_BITS 10
+#define PN_LIST_BLOOM_HASHES 7
+
 /**
  * Application/API syntax
  */
 #define PN_SYNTAX "<action(s)> <number> [argument(s)]"
+#define PN_CHAT_SYNTAX "[argument(s)]"
+#define PN_API_SYNTAX PN_SYNTAX " | trace dump | top [caller|destination] [k] | top reset | cache stats | async <action(s)> <number> [argument(s)] | list reload"
+
+/**
+ * API subcommands
+ */
+#define PN_API_TRACE "trace"
+#define PN_API_TRACE_DUMP "dump"
+#define PN_API_TOP "top"
+#define PN_API_TOP_RESET "reset"
+#define PN_API_CACHE "cache"
+#define PN_API_CACHE_STATS "stats"
+#define PN_API_ASYNC "async"
+#define PN_API_LIST "list"
+#define PN_API_LIST_RELOAD "reload"
+
+/**
+ * Chat application: message address headers and the actions run on them
+ */
+#define PN_CHAT_FROM "from"
+#define PN_CHAT_TO "to"
+#define PN_CHAT_ACTIONS "format,get_region_code,get_number_type"
 
 /**
  * Action function helper
@@ -54,6 +248,7 @@ using i18n::phonenumbers::PhoneNumberUtil;
  * phonenumber.conf.xml.
  */
 #define PN_DEFAULT_REGION "US"
+#define PN_UNKNOWN_REGION "ZZ"
 #define PN_DEFAULT_FORMAT PhoneNumberUtil::E164
 #define PN_DEFAULT_LOCALE "en_US"
 #define PN_DEFAULT_CALLING_FROM "US"
@@ -68,6 +263,9 @@ using i18n::phonenumbers::PhoneNumberUtil;
 #define PN_INBOUND "inbound"
 #define PN_OUTBOUND "outbound"
 #define PN_ALL "all"
+#define PN_INIT "init"
+#define PN_ROUTING "routing"
+#define PN_REPORTING "reporting"
 
 #define PN_LEN_EMPTY 0
 #define PN_LEN_NUMBER 6
@@ -76,6 +274,9 @@ using i18n::phonenumbers::PhoneNumberUtil;
 #define PN_LEN_INBOUND 7
 #define PN_LEN_OUTBOUND 8
 #define PN_LEN_ALL 3
+#define PN_LEN_INIT 4
+#define PN_LEN_ROUTING 7
+#define PN_LEN_REPORTING 9
 
 #define PN_PARAM_DEFAULT_REGION "default_region"
 #define PN_PARAM_FORMAT "format"
@@ -85,6 +286,26 @@ using i18n::phonenumbers::PhoneNumberUtil;
 #define PN_PARAM_CONTEXT "context"
 #define PN_PARAM_SCOPE "scope"
 #define PN_PARAM_ACTIONS "actions"
+#define PN_PARAM_TRACE_SIZE "trace_size"
+#define PN_PARAM_SLOW_THRESHOLD "slow_threshold"
+#define PN_PARAM_TOP_SIZE "top_size"
+#define PN_PARAM_TOP_DECAY "top_decay"
+#define PN_PARAM_PROPAGATE "propagate"
+#define PN_PARAM_PHASE "phase"
+#define PN_PARAM_CACHE_SIZE "cache_size"
+#define PN_PARAM_CACHE_PATH "cache_path"
+#define PN_PARAM_SNAPSHOT_PATH "snapshot_path"
+#define PN_PARAM_SNAPSHOT_SIZE "snapshot_size"
+#define PN_PARAM_SNAPSHOT_INTERVAL "snapshot_interval"
+#define PN_PARAM_ASYNC_WORKERS "async_workers"
+#define PN_PARAM_ASYNC_QUEUE_SIZE "async_queue_size"
+#define PN_PARAM_LIST "list"
+#define PN_PARAM_TRANSLATION "translation"
+#define PN_PARAM_CALLER_PREFIX "caller_prefix"
+#define PN_PARAM_DESTINATION_PREFIX "destination_prefix"
+#define PN_PARAM_MATCH_VARIABLE "match_variable"
+#define PN_PARAM_PROFILE "profile="
+#define PN_PARAM_PROFILE_VARIABLE "profile_variable"
 
 #define PN_PARAM_LEN_DEFAULT_REGION 14
 #define PN_PARAM_LEN_FORMAT 6
@@ -94,6 +315,26 @@ using i18n::phonenumbers::PhoneNumberUtil;
 #define PN_PARAM_LEN_CONTEXT 7
 #define PN_PARAM_LEN_SCOPE 5
 #define PN_PARAM_LEN_ACTIONS 7
+#define PN_PARAM_LEN_TRACE_SIZE 10
+#define PN_PARAM_LEN_SLOW_THRESHOLD 14
+#define PN_PARAM_LEN_TOP_SIZE 8
+#define PN_PARAM_LEN_TOP_DECAY 9
+#define PN_PARAM_LEN_PROPAGATE 9
+#define PN_PARAM_LEN_PHASE 5
+#define PN_PARAM_LEN_CACHE_SIZE 10
+#define PN_PARAM_LEN_CACHE_PATH 10
+#define PN_PARAM_LEN_SNAPSHOT_PATH 13
+#define PN_PARAM_LEN_SNAPSHOT_SIZE 13
+#define PN_PARAM_LEN_SNAPSHOT_INTERVAL 17
+#define PN_PARAM_LEN_ASYNC_WORKERS 13
+#define PN_PARAM_LEN_ASYNC_QUEUE_SIZE 16
+#define PN_PARAM_LEN_LIST 4
+#define PN_PARAM_LEN_TRANSLATION 11
+#define PN_PARAM_LEN_CALLER_PREFIX 13
+#define PN_PARAM_LEN_DESTINATION_PREFIX 18
+#define PN_PARAM_LEN_MATCH_VARIABLE 14
+#define PN_PARAM_LEN_PROFILE 8
+#define PN_PARAM_LEN_PROFILE_VARIABLE 16
 
 #define PN_ACTION_IS_ALPHA_NUMBER "is_alpha_number"
 #define PN_ACTION_CONVERT_ALPHA_CHARACTERS_IN_NUMBER "convert_alpha_characters_in_number"
@@ -108,6 +349,11 @@ using i18n::phonenumbers::PhoneNumberUtil;
 #define PN_ACTION_IS_POSSIBLE_NUMBER_WITH_REASON "is_possible_number_with_reason"
 #define PN_ACTION_IS_POSSIBLE_NUMBER "is_possible_number"
 #define PN_ACTION_GET_DESCRIPTION_FOR_NUMBER "get_description_for_number"
+#define PN_ACTION_EXTRACT "extract"
+#define PN_ACTION_IS_LISTED "is_listed"
+#define PN_ACTION_IS_VALID_NUMBER "is_valid_number"
+#define PN_ACTION_KEY "key"
+#define PN_ACTION_TRANSLATE "translate"
 
 #define PN_ACTION_LEN_IS_ALPHA_NUMBER 15
 #define PN_ACTION_LEN_CONVERT_ALPHA_CHARACTERS_IN_NUMBER 34
@@ -122,6 +368,11 @@ using i18n::phonenumbers::PhoneNumberUtil;
 #define PN_ACTION_LEN_IS_POSSIBLE_NUMBER_WITH_REASON 30
 #define PN_ACTION_LEN_IS_POSSIBLE_NUMBER 18
 #define PN_ACTION_LEN_GET_DESCRIPTION_FOR_NUMBER 26
+#define PN_ACTION_LEN_EXTRACT 7
+#define PN_ACTION_LEN_IS_LISTED 9
+#define PN_ACTION_LEN_IS_VALID_NUMBER 15
+#define PN_ACTION_LEN_KEY 3
+#define PN_ACTION_LEN_TRANSLATE 9
 
 #define PN_FORMAT_E164 "E164"
 #define PN_FORMAT_INTERNATIONAL "INTERNATIONAL"
@@ -133,37 +384,211 @@ using i18n::phonenumbers::PhoneNumberUtil;
 #define PN_FORMAT_LEN_NATIONAL 8
 #define PN_FORMAT_LEN_RFC3966 7
 
+#define PN_ERROR_NONE "NONE"
+#define PN_ERROR_INVALID_COUNTRY_CODE "INVALID_COUNTRY_CODE"
+#define PN_ERROR_NOT_A_NUMBER "NOT_A_NUMBER"
+#define PN_ERROR_TOO_SHORT_AFTER_IDD "TOO_SHORT_AFTER_IDD"
+#define PN_ERROR_TOO_SHORT_NSN "TOO_SHORT_NSN"
+#define PN_ERROR_TOO_LONG_NSN "TOO_LONG_NSN"
+#define PN_ERROR_NOT_PARSED "NOT_PARSED"
+#define PN_ERROR_EMPTY "EMPTY"
+#define PN_ERROR_TOO_LONG "TOO_LONG"
+#define PN_ERROR_NO_DIGITS "NO_DIGITS"
+#define PN_ERROR_URI "URI"
+#define PN_ERROR_INVALID_CHARACTERS "INVALID_CHARACTERS"
+#define PN_ERROR_SENTINEL "SENTINEL"
+
+#define PN_TYPE_FIXED_LINE "FIXED_LINE"
+#define PN_TYPE_MOBILE "MOBILE"
+#define PN_TYPE_FIXED_LINE_OR_MOBILE "FIXED_LINE_OR_MOBILE"
+#define PN_TYPE_TOLL_FREE "TOLL_FREE"
+#define PN_TYPE_PREMIUM_RATE "PREMIUM_RATE"
+#define PN_TYPE_SHARED_COST "SHARED_COST"
+#define PN_TYPE_VOIP "VOIP"
+#define PN_TYPE_PERSONAL_NUMBER "PERSONAL_NUMBER"
+#define PN_TYPE_PAGER "PAGER"
+#define PN_TYPE_UAN "UAN"
+#define PN_TYPE_VOICEMAIL "VOICEMAIL"
+#define PN_TYPE_UNKNOWN "UNKNOWN"
+
+/**
+ * Action guards
+ *
+ * Guards are listed among the actions as "?<condition>" (or "?!<condition>"
+ * to negate it); when a guard does not hold, the actions which follow it are
+ * skipped.
+ */
+#define PN_GUARD_PREFIX '?'
+#define PN_GUARD_NEGATE '!'
+#define PN_GUARD_SEPARATOR '|'
+#define PN_GUARD_MAX_REGIONS 8
+
+#define PN_GUARD_VALID "valid"
+#define PN_GUARD_POSSIBLE "possible"
+#define PN_GUARD_TYPE "type="
+#define PN_GUARD_REGION "region="
+
+#define PN_GUARD_LEN_TYPE 5
+#define PN_GUARD_LEN_REGION 7
+
+/**
+ * Hook predicates
+ *
+ * Every hook is identified by a bit in a 64-bit mask; prefixes are matched
+ * against the raw caller/destination numbers through a trie (digits and +),
+ * channel variables by exact value. Hooks past the first PN_MAX_HOOKS have no
+ * bit, they are evaluated for every channel and cannot carry predicates.
+ */
+#define PN_MAX_HOOKS 64
+#define PN_MATCH_SEPARATOR '|'
+#define PN_TRIE_FANOUT 11
+
+/**
+ * Routing rules (dialplan interface)
+ *
+ * Rules are indexed by a "<region>:<type>:<valid>" key, where any of the
+ * components can be replaced by the PN_ROUTE_ANY wildcard.
+ */
+#define PN_ROUTE_ANY "*"
+#define PN_ROUTE_KEY_LEN 32
+
+/**
+ * Translation rules (translate action)
+ *
+ * Rule sets are picked by the translation argument and keyed like the routing
+ * rules. Besides the libphonenumber formats, a rule can render the number as
+ * dialed from another region (PN_TRANSLATE_OUT_OF_COUNTRY) or as its national
+ * significant number (PN_TRANSLATE_NSN), then strip the non-digits and prepend
+ * a fixed prefix.
+ */
+#define PN_TRANSLATION_NAME_LEN 32
+#define PN_TRANSLATE_PREFIX_LEN 16
+#define PN_TRANSLATE_LEN 64
+
+#define PN_TRANSLATE_OUT_OF_COUNTRY "OUT_OF_COUNTRY"
+#define PN_TRANSLATE_NSN "NSN"
+
+/**
+ * Hook signature (hex encoded hash of the hook's actions and configuration),
+ * used to decide whether results computed on another leg can be reused.
+ */
+#define PN_SIGNATURE_LEN 17
+
+/**
+ * Propagation record, set by a propagating hook on its channel as
+ * phonenumber_<prefix>_propagate_<signature> and holding the input and the
+ * results that very hook produced ("<input>\n<suffix>=<value>\n...").
+ */
+#define PN_PROPAGATE_VARIABLE "propagate_"
+#define PN_PROPAGATE_VARIABLE_LEN 64
+
+/**
+ * Channel variable pointing to the other leg of a loopback pair
+ */
+#define PN_LOOPBACK_VARIABLE "other_loopback_leg_uuid"
+
+/**
+ * Session memo, stored as channel private data; a channel keeps track of at
+ * most PN_MEMO_MAX (prefix, number, configuration) combinations.
+ */
+#define PN_MEMO_PRIVATE "mod_phonenumber_memo"
+#define PN_MEMO_MAX 16
+
 /**
  * Type definitions
  */
 struct phonenumber_config {
   char default_region[3];
+  char candidates[PN_REGION_CANDIDATES_LEN];
   PhoneNumberUtil::PhoneNumberFormat format;
   char locale[6];
   char calling_from[3];
+  char list[PN_LIST_NAME_LEN];
+  char translation[PN_TRANSLATION_NAME_LEN];
 };
 
 typedef struct phonenumber_config phonenumber_config_t;
 
+struct phonenumber_capture {
+  char suffix[PN_CACHE_SUFFIX_LEN];
+  char value[PN_CACHE_VALUE_LEN];
+  bool set;
+  bool overflow;
+};
+
+typedef struct phonenumber_capture phonenumber_capture_t;
+
 struct phonenumber_request {
   char *number;
   phonenumber_config_t *config;
   PhoneNumber *parsed;
   switch_channel_t *channel;
   switch_stream_handle_t *stream;
+  switch_event_t *event;
   char *prefix;
+  phonenumber_capture_t *capture;
+  switch_stream_handle_t *record;
 };
 
 typedef struct phonenumber_request phonenumber_request_t;
 
 typedef void (*phonenumber_action_t)(phonenumber_request_t *request);
 
+enum phonenumber_action_id {
+  ACTION_IS_ALPHA_NUMBER,
+  ACTION_CONVERT_ALPHA_CHARACTERS_IN_NUMBER,
+  ACTION_NORMALIZE_DIGITS_ONLY,
+  ACTION_NORMALIZE_DIALLABLE_CHARS_ONLY,
+  ACTION_GET_NATIONAL_SIGNIFICANT_NUMBER,
+  ACTION_FORMAT_OUT_OF_COUNTRY_CALLING_NUMBER,
+  ACTION_FORMAT,
+  ACTION_GET_NUMBER_TYPE,
+  ACTION_IS_VALID_NUMBER_FOR_REGION,
+  ACTION_GET_REGION_CODE,
+  ACTION_IS_POSSIBLE_NUMBER_WITH_REASON,
+  ACTION_IS_POSSIBLE_NUMBER,
+  ACTION_GET_DESCRIPTION_FOR_NUMBER,
+  ACTION_EXTRACT,
+  ACTION_IS_LISTED,
+  ACTION_IS_VALID_NUMBER,
+  ACTION_KEY,
+  ACTION_TRANSLATE,
+  ACTION_UNKNOWN
+};
+
+enum phonenumber_guard {
+  GUARD_NONE,
+  GUARD_VALID,
+  GUARD_POSSIBLE,
+  GUARD_TYPE,
+  GUARD_REGION
+};
+
+struct phonenumber_step {
+  phonenumber_action_t action;
+  phonenumber_guard guard;
+  bool negate;
+  uint32_t types;
+  uint8_t regionc;
+  char regions[PN_GUARD_MAX_REGIONS][3];
+};
+
+typedef struct phonenumber_step phonenumber_step_t;
+
 enum phonenumber_direction {
   DIRECTION_ALL,
   DIRECTION_INBOUND,
   DIRECTION_OUTBOUND
 };
 
+enum phonenumber_phase {
+  PHASE_INIT,
+  PHASE_ROUTING,
+  PHASE_REPORTING
+};
+
+#define PN_PHASES (PHASE_REPORTING + 1)
+
 enum phonenumber_scope {
   SCOPE_ALL,
   SCOPE_CALLER,
@@ -174,13 +599,190 @@ struct phonenumber_hook {
   char *context;
   phonenumber_direction direction;
   phonenumber_scope scope;
+  phonenumber_phase phase;
   phonenumber_config config;
-  phonenumber_action_t *actions;
+  phonenumber_step_t *actions;
+  bool propagate;
+  bool profiled;
+  bool disabled;
+  uint32_t index;
+  uint64_t bit;
+  char signature[PN_SIGNATURE_LEN];
   struct phonenumber_hook *next;
 };
 
 typedef struct phonenumber_hook phonenumber_hook_t;
 
+struct phonenumber_memo {
+  char *prefix;
+  char *number;
+  phonenumber_config_t config;
+  bool parsed;
+  int error;
+  char matched_region[3];
+  PhoneNumber number_parsed;
+  uint64_t done;
+  struct phonenumber_memo *next;
+};
+
+typedef struct phonenumber_memo phonenumber_memo_t;
+
+struct phonenumber_route_action {
+  char *application;
+  char *data;
+  struct phonenumber_route_action *next;
+};
+
+typedef struct phonenumber_route_action phonenumber_route_action_t;
+
+struct phonenumber_profile {
+  char *name;
+  phonenumber_config_t config;
+  struct phonenumber_profile *next;
+};
+
+typedef struct phonenumber_profile phonenumber_profile_t;
+
+struct phonenumber_route {
+  char *key;
+  phonenumber_route_action_t *actions;
+  struct phonenumber_route *next;
+};
+
+typedef struct phonenumber_route phonenumber_route_t;
+
+enum phonenumber_translate_mode {
+  TRANSLATE_FORMAT,
+  TRANSLATE_OUT_OF_COUNTRY,
+  TRANSLATE_NSN
+};
+
+struct phonenumber_translation_rule {
+  char key[PN_ROUTE_KEY_LEN];
+  phonenumber_translate_mode mode;
+  PhoneNumberUtil::PhoneNumberFormat format;
+  char calling_from[3];
+  char prefix[PN_TRANSLATE_PREFIX_LEN];
+  bool digits_only;
+  struct phonenumber_translation_rule *next;
+};
+
+typedef struct phonenumber_translation_rule phonenumber_translation_rule_t;
+
+struct phonenumber_translation {
+  char *name;
+  switch_hash_t *index;
+  phonenumber_translation_rule_t *rules;
+  struct phonenumber_translation *next;
+};
+
+typedef struct phonenumber_translation phonenumber_translation_t;
+
+struct phonenumber_trace {
+  std::atomic<uint64_t> seq;
+  switch_time_t timestamp;
+  uint64_t start;
+  uint64_t mark;
+  char input[PN_TRACE_INPUT_LEN];
+  char prefix[PN_TRACE_PREFIX_LEN];
+  int error;
+  uint32_t parse_us;
+  uint32_t total_us;
+  uint8_t actc;
+  uint8_t actions[PN_MAX_ACTIONS];
+  uint32_t action_us[PN_MAX_ACTIONS];
+};
+
+typedef struct phonenumber_trace phonenumber_trace_t;
+
+struct phonenumber_cache_header {
+  uint32_t magic;
+  uint32_t slots;
+  uint64_t fingerprint;
+  char version[PN_CACHE_VERSION_LEN];
+  std::atomic<uint64_t> hits;
+  std::atomic<uint64_t> misses;
+};
+
+typedef struct phonenumber_cache_header phonenumber_cache_header_t;
+
+struct phonenumber_cache_slot {
+  std::atomic<uint32_t> seq;
+  std::atomic<uint32_t> hits;
+  uint64_t hash;
+  uint8_t action;
+  char key[PN_CACHE_KEY_LEN];
+  char suffix[PN_CACHE_SUFFIX_LEN];
+  char value[PN_CACHE_VALUE_LEN];
+};
+
+typedef struct phonenumber_cache_slot phonenumber_cache_slot_t;
+
+struct phonenumber_snapshot_header {
+  uint32_t magic;
+  uint32_t count;
+  uint64_t fingerprint;
+  char version[PN_CACHE_VERSION_LEN];
+};
+
+typedef struct phonenumber_snapshot_header phonenumber_snapshot_header_t;
+
+struct phonenumber_job {
+  char uuid[SWITCH_UUID_FORMATTED_LENGTH + 1];
+  char *actions;
+  char *number;
+  char *config;
+};
+
+typedef struct phonenumber_job phonenumber_job_t;
+
+struct phonenumber_list {
+  char name[PN_LIST_NAME_LEN];
+  char *path;
+  void *map;
+  size_t length;
+  uint64_t *bloom;
+  uint64_t bloom_mask;
+  uint64_t *entries;
+  size_t count;
+  struct phonenumber_list *next;
+};
+
+typedef struct phonenumber_list phonenumber_list_t;
+
+struct phonenumber_trie_node {
+  uint32_t children[PN_TRIE_FANOUT];
+  uint64_t hooks;
+};
+
+typedef struct phonenumber_trie_node phonenumber_trie_node_t;
+
+struct phonenumber_trie {
+  phonenumber_trie_node_t *nodes;
+  uint32_t count;
+  uint32_t size;
+  uint64_t any;
+};
+
+typedef struct phonenumber_trie phonenumber_trie_t;
+
+struct phonenumber_match_value {
+  char *value;
+  uint64_t hooks;
+  struct phonenumber_match_value *next;
+};
+
+typedef struct phonenumber_match_value phonenumber_match_value_t;
+
+struct phonenumber_match_variable {
+  char *name;
+  uint64_t hooks;
+  phonenumber_match_value_t *values;
+  struct phonenumber_match_variable *next;
+};
+
+typedef struct phonenumber_match_variable phonenumber_match_variable_t;
+
 /**
  * All implemented actions
  */
@@ -197,27 +799,146 @@ PN_ACTION(get_region_code);
 PN_ACTION(is_possible_number_with_reason);
 PN_ACTION(is_possible_number);
 PN_ACTION(get_description_for_number);
+PN_ACTION(extract);
+PN_ACTION(is_listed);
+PN_ACTION(is_valid_number);
+PN_ACTION(key);
+PN_ACTION(translate);
 
 /**
  * Globals
  */
 extern phonenumber_config_t mod_phonenumber_config;
 extern phonenumber_hook_t *mod_phonenumber_hooks;
+extern uint32_t mod_phonenumber_phase_hooks[PN_PHASES];
+extern phonenumber_route_t *mod_phonenumber_routes;
+extern switch_hash_t *mod_phonenumber_routes_index;
+extern phonenumber_profile_t *mod_phonenumber_profiles;
+extern switch_hash_t *mod_phonenumber_profiles_index;
+extern char *mod_phonenumber_profile_variable;
+extern phonenumber_translation_t *mod_phonenumber_translations;
+extern switch_hash_t *mod_phonenumber_translations_index;
+extern uint32_t mod_phonenumber_trace_size;
+extern uint32_t mod_phonenumber_slow_threshold;
+extern uint32_t mod_phonenumber_top_size;
+extern uint32_t mod_phonenumber_top_decay;
+extern uint32_t mod_phonenumber_cache_size;
+extern char *mod_phonenumber_cache_path;
+extern char *mod_phonenumber_snapshot_path;
+extern uint32_t mod_phonenumber_snapshot_size;
+extern uint32_t mod_phonenumber_snapshot_interval;
+extern uint32_t mod_phonenumber_async_workers;
+extern uint32_t mod_phonenumber_async_queue_size;
+extern phonenumber_list_t *mod_phonenumber_lists;
 extern const PhoneNumberUtil &phone_util;
 
 /**
  * Helper functions
  */
 switch_status_t pn_util_do_config();
-phonenumber_config_t *pn_util_parse_config(char *str);
-phonenumber_action_t *pn_util_parse_actions(char *str);
-void pn_util_exec(phonenumber_action_t *actions, phonenumber_request_t *request);
+phonenumber_config_t *pn_util_parse_config(char *str, switch_channel_t *channel);
+phonenumber_config_t *pn_util_channel_profile(switch_channel_t *channel);
+phonenumber_step_t *pn_util_parse_actions(char *str);
+bool pn_util_actions_empty(phonenumber_step_t *actions);
+void pn_util_exec(phonenumber_step_t *actions, phonenumber_request_t *request);
+int pn_util_prefilter(const char *number);
+int pn_util_parse(phonenumber_request_t *request, PhoneNumber *number, char *matched);
+uint64_t pn_util_hash(const char *str);
+void pn_util_signature(const char *base, const phonenumber_config_t *config, char *signature);
+void pn_util_lengths_init();
+bool pn_util_is_possible(const PhoneNumber &number);
+bool pn_util_pack_key(const PhoneNumber &number, phonenumber_key_t *key);
+bool pn_util_format_e164(const PhoneNumber &number, char *buf, size_t len);
+void pn_util_memo_destroy(switch_channel_t *channel);
+void pn_util_set_error(phonenumber_request_t *request, int error);
+void pn_util_emit(phonenumber_request_t *request, const char *suffix, const char *value);
 phonenumber_action_t pn_util_match_action_function(char *action);
+bool pn_util_action_requires_parse(phonenumber_action_t action);
+bool pn_util_action_is_cacheable(phonenumber_action_t action);
+phonenumber_action_id pn_util_action_to_id(phonenumber_action_t action);
+const char *pn_util_action_id_to_str(phonenumber_action_id id);
+const char *pn_util_error_to_str(int error);
 PhoneNumberUtil::PhoneNumberFormat pn_util_str_to_format(char *format);
 const char *pn_util_format_to_str(PhoneNumberUtil::PhoneNumberFormat format);
 phonenumber_scope pn_util_str_to_scope(char *scope);
 const char *pn_util_scope_to_str(phonenumber_scope scope);
 phonenumber_direction pn_util_str_to_direction(char *direction);
 const char *pn_util_direction_to_str(phonenumber_direction direction);
+phonenumber_phase pn_util_str_to_phase(char *phase);
+const char *pn_util_phase_to_str(phonenumber_phase phase);
+PhoneNumberUtil::PhoneNumberType pn_util_str_to_type(const char *type);
+const char *pn_util_type_to_str(PhoneNumberUtil::PhoneNumberType type);
+void pn_util_route_key(char *key, const char *region, const char *type, const char *valid);
+void *pn_util_match_rule(switch_hash_t *index, const char *region, const char *type, bool valid);
+phonenumber_route_t *pn_util_match_route(const char *region, const char *type, bool valid);
+
+/**
+ * Tracing (ring buffer and slow lookup log)
+ */
+switch_status_t pn_trace_init();
+void pn_trace_destroy();
+bool pn_trace_enabled();
+uint64_t pn_trace_now();
+void pn_trace_begin(phonenumber_trace_t *trace, phonenumber_request_t *request);
+void pn_trace_parse(phonenumber_trace_t *trace, int error);
+void pn_trace_action(phonenumber_trace_t *trace, phonenumber_action_t action);
+void pn_trace_end(phonenumber_trace_t *trace);
+void pn_trace_dump(switch_stream_handle_t *stream);
+
+/**
+ * Heavy hitter tracking
+ */
+switch_status_t pn_top_init(switch_memory_pool_t *pool);
+void pn_top_destroy();
+bool pn_top_enabled();
+void pn_top_reset();
+void pn_top_update(const char *prefix, const char *number);
+void pn_top_dump(switch_stream_handle_t *stream, phonenumber_scope scope, uint32_t k);
+
+/**
+ * Shared lookup cache
+ */
+switch_status_t pn_cache_init();
+void pn_cache_destroy();
+bool pn_cache_enabled();
+uint64_t pn_cache_fingerprint();
+bool pn_cache_key(phonenumber_request_t *request, char *key);
+bool pn_cache_get(const char *key, phonenumber_action_id action, phonenumber_capture_t *capture);
+void pn_cache_put(const char *key, phonenumber_action_id action, phonenumber_capture_t *capture);
+bool pn_cache_read_slot(uint32_t index, phonenumber_action_id *action, char *key, phonenumber_capture_t *capture, uint32_t *hits);
+void pn_cache_stats(switch_stream_handle_t *stream);
+
+/**
+ * Warm-start snapshot
+ */
+switch_status_t pn_snapshot_init(switch_memory_pool_t *pool);
+void pn_snapshot_destroy();
+switch_status_t pn_snapshot_load();
+switch_status_t pn_snapshot_save();
+
+/**
+ * Asynchronous lookups
+ */
+switch_status_t pn_async_init(switch_memory_pool_t *pool);
+void pn_async_destroy();
+void pn_async_submit(const char *actions, const char *number, const char *config, switch_stream_handle_t *stream);
+
+/**
+ * Hook predicates
+ */
+void pn_match_hook(uint64_t bit);
+bool pn_match_add_prefixes(phonenumber_scope scope, const char *prefixes, uint64_t bit);
+bool pn_match_add_variable(const char *condition, uint64_t bit);
+uint64_t pn_match_hooks(switch_channel_t *channel, switch_caller_profile_t *profile);
+void pn_match_destroy();
+
+/**
+ * Membership lists
+ */
+switch_status_t pn_list_init(switch_memory_pool_t *pool);
+void pn_list_destroy();
+switch_status_t pn_list_reload(switch_stream_handle_t *stream);
+bool pn_list_pack(const char *number, uint64_t *packed);
+bool pn_list_contains(const char *name, uint64_t packed);
 
 #endif /* MOD_PHONENUMBER_H */
@@ -20,14 +20,19 @@
  * SOFTWARE.
  */
 
+#include <inttypes.h>
 #include <stdio.h>
 
 using namespace std;
 
 #include "phonenumbers/geocoding/phonenumber_offline_geocoder.h"
 #include "phonenumbers/phonenumber.pb.h"
+#include "phonenumbers/phonenumbermatch.h"
+#include "phonenumbers/phonenumbermatcher.h"
 
 using i18n::phonenumbers::PhoneNumber;
+using i18n::phonenumbers::PhoneNumberMatch;
+using i18n::phonenumbers::PhoneNumberMatcher;
 using i18n::phonenumbers::PhoneNumberOfflineGeocoder;
 
 #include "mod_phonenumber.h"
@@ -46,14 +51,7 @@ PN_ACTION(is_alpha_number)
 
   strcpy(response, phone_util.IsAlphaNumber(request->number) ? "true" : "false");
 
-  if (request->channel) {
-    switch_channel_set_variable_name_printf(request->channel, response, "phonenumber_%s_is_alpha_number", request->prefix);
-    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "phonenumber_%s_is_alpha_number := %s\n", request->prefix, response);
-  }
-
-  if (request->stream) {
-    request->stream->write_function(request->stream, "%s\n", response);
-  }
+  pn_util_emit(request, "is_alpha_number", response);
 }
 
 /**
@@ -68,14 +66,7 @@ PN_ACTION(convert_alpha_characters_in_number)
 
   phone_util.ConvertAlphaCharactersInNumber(&converted);
 
-  if (request->channel) {
-    switch_channel_set_variable_name_printf(request->channel, converted.c_str(), "phonenumber_%s_alpha_characters_in_number", request->prefix);
-    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "phonenumber_%s_alpha_characters_in_number := %s\n", request->prefix, converted.c_str());
-  }
-
-  if (request->stream) {
-    request->stream->write_function(request->stream, "%s\n", converted.c_str());
-  }
+  pn_util_emit(request, "alpha_characters_in_number", converted.c_str());
 }
 
 /**
@@ -91,14 +82,7 @@ PN_ACTION(normalize_digits_only)
 
   phone_util.NormalizeDigitsOnly(&normalized);
 
-  if (request->channel) {
-    switch_channel_set_variable_name_printf(request->channel, normalized.c_str(), "phonenumber_%s_digits_only", request->prefix);
-    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "phonenumber_%s_digits_only := %s\n", request->prefix, normalized.c_str());
-  }
-
-  if (request->stream) {
-    request->stream->write_function(request->stream, "%s\n", normalized.c_str());
-  }
+  pn_util_emit(request, "digits_only", normalized.c_str());
 }
 
 /**
@@ -114,14 +98,7 @@ PN_ACTION(normalize_diallable_chars_only)
 
   phone_util.NormalizeDiallableCharsOnly(&normalized);
 
-  if (request->channel) {
-    switch_channel_set_variable_name_printf(request->channel, normalized.c_str(), "phonenumber_%s_diallable_chars_only", request->prefix);
-    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "phonenumber_%s_diallable_chars_only := %s\n", request->prefix, normalized.c_str());
-  }
-
-  if (request->stream) {
-    request->stream->write_function(request->stream, "%s\n", normalized.c_str());
-  }
+  pn_util_emit(request, "diallable_chars_only", normalized.c_str());
 }
 
 /**
@@ -136,14 +113,7 @@ PN_ACTION(get_national_significant_number)
 
   phone_util.GetNationalSignificantNumber(*(request->parsed), &national_significant_num);
 
-  if (request->channel) {
-    switch_channel_set_variable_name_printf(request->channel, national_significant_num.c_str(), "phonenumber_%s_national_significant_number", request->prefix);
-    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "phonenumber_%s_national_significant_number := %s\n", request->prefix, national_significant_num.c_str());
-  }
-
-  if (request->stream) {
-    request->stream->write_function(request->stream, "%s\n", national_significant_num.c_str());
-  }
+  pn_util_emit(request, "national_significant_number", national_significant_num.c_str());
 }
 
 /**
@@ -162,14 +132,7 @@ PN_ACTION(format_out_of_country_calling_number)
 
   phone_util.FormatOutOfCountryCallingNumber(*(request->parsed), request->config->calling_from, &formatted);
 
-  if (request->channel) {
-    switch_channel_set_variable_name_printf(request->channel, formatted.c_str(), "phonenumber_%s_out_of_country_calling_number", request->prefix);
-    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "phonenumber_%s_out_of_country_calling_number := %s\n", request->prefix, formatted.c_str());
-  }
-
-  if (request->stream) {
-    request->stream->write_function(request->stream, "%s\n", formatted.c_str());
-  }
+  pn_util_emit(request, "out_of_country_calling_number", formatted.c_str());
 }
 
 /**
@@ -184,18 +147,18 @@ PN_ACTION(format_out_of_country_calling_number)
  */
 PN_ACTION(format)
 {
+  char e164[PN_E164_LEN];
   string formatted;
 
-  phone_util.Format(*(request->parsed), request->config->format, &formatted);
-
-  if (request->channel) {
-    switch_channel_set_variable_name_printf(request->channel, formatted.c_str(), "phonenumber_%s_format", request->prefix);
-    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "phonenumber_%s_format := %s\n", request->prefix, formatted.c_str());
+  /* E.164 (the default) is written directly, the other formats depend on the region's patterns */
+  if ((request->config->format == PhoneNumberUtil::E164) && pn_util_format_e164(*(request->parsed), e164, sizeof(e164))) {
+    pn_util_emit(request, "format", e164);
+    return;
   }
 
-  if (request->stream) {
-    request->stream->write_function(request->stream, "%s\n", formatted.c_str());
-  }
+  phone_util.Format(*(request->parsed), request->config->format, &formatted);
+
+  pn_util_emit(request, "format", formatted.c_str());
 }
 
 /**
@@ -205,60 +168,9 @@ PN_ACTION(format)
  */
 PN_ACTION(get_number_type)
 {
-  char response[21];
-
-  PhoneNumberUtil::PhoneNumberType type = phone_util.GetNumberType(*(request->parsed));
+  const char *response = pn_util_type_to_str(phone_util.GetNumberType(*(request->parsed)));
 
-  switch (type) {
-  case PhoneNumberUtil::FIXED_LINE:
-    strcpy(response, "FIXED_LINE");
-    break;
-  case PhoneNumberUtil::FIXED_LINE_OR_MOBILE:
-    strcpy(response, "FIXED_LINE_OR_MOBILE");
-    break;
-  case PhoneNumberUtil::MOBILE:
-    strcpy(response, "MOBILE");
-    break;
-  case PhoneNumberUtil::PAGER:
-    strcpy(response, "PAGER");
-    break;
-  case PhoneNumberUtil::PERSONAL_NUMBER:
-    strcpy(response, "PERSONAL_NUMBER");
-    break;
-  case PhoneNumberUtil::PREMIUM_RATE:
-    strcpy(response, "PREMIUM_RATE");
-    break;
-  case PhoneNumberUtil::SHARED_COST:
-    strcpy(response, "SHARED_COST");
-    break;
-  case PhoneNumberUtil::TOLL_FREE:
-    strcpy(response, "TOLL_FREE");
-    break;
-  case PhoneNumberUtil::UAN:
-    strcpy(response, "UAN");
-    break;
-  case PhoneNumberUtil::UNKNOWN:
-    strcpy(response, "UNKNOWN");
-    break;
-  case PhoneNumberUtil::VOICEMAIL:
-    strcpy(response, "VOICEMAIL");
-    break;
-  case PhoneNumberUtil::VOIP:
-    strcpy(response, "VOIP");
-    break;
-  default:
-    strcpy(response, "UNKNOWN");
-    break;
-  }
-
-  if (request->channel) {
-    switch_channel_set_variable_name_printf(request->channel, response, "phonenumber_%s_number_type", request->prefix);
-    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "phonenumber_%s_number_type := %s\n", request->prefix, response);
-  }
-
-  if (request->stream) {
-    request->stream->write_function(request->stream, "%s\n", response);
-  }
+  pn_util_emit(request, "number_type", response);
 }
 
 /**
@@ -272,14 +184,7 @@ PN_ACTION(is_valid_number_for_region)
 
   strcpy(response, phone_util.IsValidNumberForRegion(*(request->parsed), request->config->default_region) ? "true" : "false");
 
-  if (request->channel) {
-    switch_channel_set_variable_name_printf(request->channel, response, "phonenumber_%s_valid_number_for_region", request->prefix);
-    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "phonenumber_%s_valid_number_for_region := %s\n", request->prefix, response);
-  }
-
-  if (request->stream) {
-    request->stream->write_function(request->stream, "%s\n", response);
-  }
+  pn_util_emit(request, "valid_number_for_region", response);
 }
 
 /**
@@ -296,14 +201,7 @@ PN_ACTION(get_region_code)
 
   phone_util.GetRegionCodeForNumber(*(request->parsed), &region_code);
 
-  if (request->channel) {
-    switch_channel_set_variable_name_printf(request->channel, region_code.c_str(), "phonenumber_%s_region_code", request->prefix);
-    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "phonenumber_%s_region_code := %s\n", request->prefix, region_code.c_str());
-  }
-
-  if (request->stream) {
-    request->stream->write_function(request->stream, "%s\n", region_code.c_str());
-  }
+  pn_util_emit(request, "region_code", region_code.c_str());
 }
 
 /**
@@ -335,35 +233,39 @@ PN_ACTION(is_possible_number_with_reason)
     break;
   }
 
-  if (request->channel) {
-    switch_channel_set_variable_name_printf(request->channel, response, "phonenumber_%s_is_possible_number_with_reason", request->prefix);
-    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "phonenumber_%s_is_possible_number_with_reason := %s\n", request->prefix, response);
-  }
-
-  if (request->stream) {
-    request->stream->write_function(request->stream, "%s\n", response);
-  }
+  pn_util_emit(request, "is_possible_number_with_reason", response);
 }
 
 /**
  * is_possible_number action
  *
- * Checks whether a phone number is a possible number.
+ * Checks whether a phone number is a possible number, i.e. the length of
+ * its national significant number is plausible for its country code. No
+ * pattern matching is involved, use is_valid_number for that.
  */
 PN_ACTION(is_possible_number)
 {
   char response[6];
 
-  strcpy(response, phone_util.IsValidNumber(*(request->parsed)) ? "true" : "false");
+  strcpy(response, pn_util_is_possible(*(request->parsed)) ? "true" : "false");
 
-  if (request->channel) {
-    switch_channel_set_variable_name_printf(request->channel, response, "phonenumber_%s_is_possible_number", request->prefix);
-    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "phonenumber_%s_is_possible_number := %s\n", request->prefix, response);
-  }
+  pn_util_emit(request, "is_possible_number", response);
+}
 
-  if (request->stream) {
-    request->stream->write_function(request->stream, "%s\n", response);
-  }
+/**
+ * is_valid_number action
+ *
+ * Tests whether a phone number matches a valid pattern. Unlike
+ * is_possible_number, this runs the full pattern validation against the
+ * number's region metadata.
+ */
+PN_ACTION(is_valid_number)
+{
+  char response[6];
+
+  strcpy(response, phone_util.IsValidNumber(*(request->parsed)) ? "true" : "false");
+
+  pn_util_emit(request, "is_valid_number", response);
 }
 
 /**
@@ -380,12 +282,215 @@ PN_ACTION(get_description_for_number)
 {
   string description = PhoneNumberOfflineGeocoder().GetDescriptionForNumber(*(request->parsed), icu::Locale(request->config->locale));
 
-  if (request->channel) {
-    switch_channel_set_variable_name_printf(request->channel, description.c_str(), "phonenumber_%s_description_for_number", request->prefix);
-    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "phonenumber_%s_description_for_number := %s\n", request->prefix, description.c_str());
+  pn_util_emit(request, "description_for_number", description.c_str());
+}
+
+/**
+ * is_listed action
+ *
+ * Checks whether the number (in its E.164 form) belongs to the membership
+ * list selected by the list argument, or to any of the configured lists if
+ * none is selected.
+ */
+PN_ACTION(is_listed)
+{
+  char e164[PN_E164_LEN];
+  uint64_t packed;
+  char response[6];
+
+  strcpy(response, (pn_util_format_e164(*(request->parsed), e164, sizeof(e164)) && pn_list_pack(e164, &packed) && pn_list_contains(request->config->list, packed))
+                       ? "true"
+                       : "false");
+
+  pn_util_emit(request, "is_listed", response);
+}
+
+/**
+ * key action
+ *
+ * Returns the number's canonical 64-bit key (country calling code, Italian
+ * leading zeros and national number packed together) in decimal, or 0 if
+ * the number does not fit the key layout.
+ */
+PN_ACTION(key)
+{
+  phonenumber_key_t packed = 0;
+  char response[24];
+
+  pn_util_pack_key(*(request->parsed), &packed);
+  snprintf(response, sizeof(response), "%" PRIu64, packed);
+
+  pn_util_emit(request, "key", response);
+}
+
+/**
+ * translate action
+ *
+ * Rewrites the number according to the most specific rule of the selected
+ * translation rule set (see <translations> in phonenumber.conf.xml) for its
+ * region, type and validity, e.g. to strip the national prefix or dial it
+ * internationally towards a given carrier. Returns an empty string when the
+ * rule set is unknown or none of its rules applies.
+ */
+PN_ACTION(translate)
+{
+  phonenumber_translation_t *translation = NULL;
+  phonenumber_translation_rule_t *rule = NULL;
+  PhoneNumberUtil::PhoneNumberType type;
+  char e164[PN_E164_LEN], response[PN_TRANSLATE_LEN], *out;
+  string region, formatted;
+  const char *in;
+
+  if (mod_phonenumber_translations_index && !zstr(request->config->translation)) {
+    translation = (phonenumber_translation_t *)switch_core_hash_find(mod_phonenumber_translations_index, request->config->translation);
   }
 
-  if (request->stream) {
-    request->stream->write_function(request->stream, "%s\n", description.c_str());
+  if (!translation) {
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Unknown translation: %s\n", request->config->translation);
+    pn_util_emit(request, "translate", PN_EMPTY);
+    return;
   }
+
+  phone_util.GetRegionCodeForNumber(*(request->parsed), &region);
+  type = phone_util.GetNumberType(*(request->parsed));
+
+  /* Same as the dialplan, a number is valid exactly when its type is known */
+  if (!(rule = (phonenumber_translation_rule_t *)pn_util_match_rule(translation->index, region.c_str(), pn_util_type_to_str(type),
+                                                                     type != PhoneNumberUtil::UNKNOWN))) {
+    pn_util_emit(request, "translate", PN_EMPTY);
+    return;
+  }
+
+  switch (rule->mode) {
+  case phonenumber_translate_mode::TRANSLATE_OUT_OF_COUNTRY:
+    phone_util.FormatOutOfCountryCallingNumber(*(request->parsed), rule->calling_from[0] ? rule->calling_from : request->config->calling_from, &formatted);
+    break;
+  case phonenumber_translate_mode::TRANSLATE_NSN:
+    phone_util.GetNationalSignificantNumber(*(request->parsed), &formatted);
+    break;
+  default:
+    if ((rule->format == PhoneNumberUtil::E164) && pn_util_format_e164(*(request->parsed), e164, sizeof(e164))) {
+      formatted = e164;
+    } else {
+      phone_util.Format(*(request->parsed), rule->format, &formatted);
+    }
+  }
+
+  /* Prefixes are shorter than PN_TRANSLATE_PREFIX_LEN, see pn_util_do_config */
+  strcpy(response, rule->prefix);
+  out = response + strlen(response);
+
+  for (in = formatted.c_str(); *in && (out < response + sizeof(response) - 1); in++) {
+    if (!rule->digits_only || isdigit((unsigned char)*in)) {
+      *out++ = *in;
+    }
+  }
+
+  *out = '\0';
+
+  pn_util_emit(request, "translate", response);
+}
+
+/**
+ * extract window boundary
+ *
+ * Picks where a window of at most chunk bytes ends: preferably at whitespace
+ * following a word, otherwise right after an ASCII character which cannot be
+ * part of a phone number, and in any case on a UTF-8 character boundary, as
+ * PhoneNumberMatcher gives up on invalid UTF-8. Non-ASCII characters are
+ * never cut after, they may be digits (e.g. full-width or Arabic-Indic).
+ *
+ * @param text Window start
+ * @param chunk Maximum window length, text is longer than that
+ * @return Window length
+ */
+static size_t pn_extract_cut(const char *text, size_t chunk)
+{
+  const char *number = "0123456789+-(). /\t";
+  unsigned char c;
+  size_t cut;
+
+  for (cut = chunk; cut > chunk / 2; cut--) {
+    c = (unsigned char)text[cut - 2];
+
+    if (isspace((unsigned char)text[cut - 1]) && (c < 0x80) && !isspace(c) && !strchr(number, c)) {
+      return cut;
+    }
+  }
+
+  for (cut = chunk; cut > 0; cut--) {
+    c = (unsigned char)text[cut - 1];
+
+    if ((c < 0x80) && !strchr(number, c)) {
+      return cut;
+    }
+  }
+
+  for (cut = chunk; (cut > 1) && (((unsigned char)text[cut] & 0xC0) == 0x80); cut--)
+    ;
+
+  return cut;
+}
+
+/**
+ * extract action
+ *
+ * Finds all phone numbers embedded in a free text input (e.g. SIP headers,
+ * SMS bodies or transcriptions) in a single pass and returns their spans
+ * (byte offsets within the input) along with their E.164 representation.
+ * Large inputs are scanned in windows of at most PN_EXTRACT_CHUNK bytes,
+ * split between words (see pn_extract_cut), so only one window is copied at
+ * a time. The matcher hands back already parsed
+ * numbers, so no additional parsing takes place for any of the hits.
+ */
+PN_ACTION(extract)
+{
+  string numbers, spans, formatted;
+  PhoneNumberMatch match;
+  switch_stream_handle_t *stream;
+  char span[32], e164[PN_E164_LEN];
+  size_t length = strlen(request->number), offset = 0, chunk;
+
+  while (offset < length) {
+    chunk = length - offset;
+
+    if (chunk > PN_EXTRACT_CHUNK) {
+      chunk = pn_extract_cut(request->number + offset, PN_EXTRACT_CHUNK);
+    }
+
+    PhoneNumberMatcher matcher(string(request->number + offset, chunk), request->config->default_region);
+
+    while (matcher.HasNext()) {
+      matcher.Next(&match);
+      if (pn_util_format_e164(match.number(), e164, sizeof(e164))) {
+        formatted = e164;
+      } else {
+        phone_util.Format(match.number(), PhoneNumberUtil::E164, &formatted);
+      }
+
+      snprintf(span, sizeof(span), "%zu-%zu", offset + match.start(), offset + match.end());
+
+      if (!numbers.empty()) {
+        numbers += ",";
+        spans += ",";
+      }
+
+      numbers += formatted;
+      spans += span;
+
+      if (request->stream) {
+        request->stream->write_function(request->stream, "%s %s\n", span, formatted.c_str());
+      }
+    }
+
+    offset += chunk;
+  }
+
+  /* The stream already got one line per match, the joined lists go to the
+   * other sinks */
+  stream = request->stream;
+  request->stream = NULL;
+  pn_util_emit(request, "extract", numbers.c_str());
+  pn_util_emit(request, "extract_spans", spans.c_str());
+  request->stream = stream;
 }
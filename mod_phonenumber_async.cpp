@@ -0,0 +1,272 @@
+/*
+ * Copyright (c) 2019 Ciprian Dosoftei
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+
+using namespace std;
+
+#include "mod_phonenumber.h"
+
+/**
+ * Asynchronous job queue
+ *
+ * Bounded queue of pending lookups, drained by a fixed pool of worker
+ * threads; a NULL job tells a worker to exit.
+ */
+static switch_queue_t *mod_phonenumber_async_queue = NULL;
+static switch_thread_t *mod_phonenumber_async_threads[PN_ASYNC_MAX_WORKERS];
+static uint32_t mod_phonenumber_async_running = 0;
+
+/**
+ * Asynchronous lookups configuration
+ *
+ * Number of worker threads (0 disables asynchronous lookups) and queue
+ * capacity, as defined in phonenumber.conf.xml.
+ */
+uint32_t mod_phonenumber_async_workers = 0;
+uint32_t mod_phonenumber_async_queue_size = PN_ASYNC_DEFAULT_QUEUE_SIZE;
+
+/**
+ * Job cleanup
+ *
+ * @param job Job to release
+ */
+static void pn_async_job_free(phonenumber_job_t *job)
+{
+  switch_safe_free(job->actions);
+  switch_safe_free(job->number);
+  switch_safe_free(job->config);
+  free(job);
+}
+
+/**
+ * Job runner
+ *
+ * Executes the job's actions and publishes the outcome as a
+ * phonenumber::result event, carrying the job UUID, the request and the
+ * result lines (same as the synchronous API) as the body.
+ *
+ * @param job Job to run
+ */
+static void pn_async_job_run(phonenumber_job_t *job)
+{
+  switch_stream_handle_t stream = { 0 };
+  phonenumber_request_t request;
+  phonenumber_step_t *actions;
+  switch_event_t *event = NULL;
+
+  if (switch_event_create_subclass(&event, SWITCH_EVENT_CUSTOM, PN_EVENT_RESULT) != SWITCH_STATUS_SUCCESS) {
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Cannot create %s event for job %s\n", PN_EVENT_RESULT, job->uuid);
+    return;
+  }
+
+  /* Headers first, parsing the actions/configuration alters the job strings */
+  switch_event_add_header_string(event, SWITCH_STACK_BOTTOM, "Job-UUID", job->uuid);
+  switch_event_add_header_string(event, SWITCH_STACK_BOTTOM, "Phonenumber-Actions", job->actions);
+  switch_event_add_header_string(event, SWITCH_STACK_BOTTOM, "Phonenumber-Input", job->number);
+  if (job->config) {
+    switch_event_add_header_string(event, SWITCH_STACK_BOTTOM, "Phonenumber-Config", job->config);
+  }
+
+  SWITCH_STANDARD_STREAM(stream);
+
+  actions = pn_util_parse_actions(job->actions);
+
+  request.number = job->number;
+  request.config = pn_util_parse_config(job->config, NULL);
+  request.channel = NULL;
+  request.stream = &stream;
+  request.event = NULL;
+  request.record = NULL;
+  request.prefix = NULL;
+
+  if (!pn_util_actions_empty(actions)) {
+    pn_util_exec(actions, &request);
+  } else {
+    stream.write_function(&stream, "-ERR Invalid actions\n");
+  }
+
+  switch_event_add_body(event, "%s", stream.data ? (char *)stream.data : "");
+  switch_event_fire(&event);
+
+  switch_safe_free(request.config);
+  switch_safe_free(actions);
+  switch_safe_free(stream.data);
+}
+
+/**
+ * Worker thread
+ */
+static void *SWITCH_THREAD_FUNC pn_async_worker(switch_thread_t *thread, void *obj)
+{
+  void *pop = NULL;
+
+  while (switch_queue_pop(mod_phonenumber_async_queue, &pop) == SWITCH_STATUS_SUCCESS) {
+    phonenumber_job_t *job = (phonenumber_job_t *)pop;
+
+    if (!job) {
+      break;
+    }
+
+    pn_async_job_run(job);
+    pn_async_job_free(job);
+  }
+
+  return NULL;
+}
+
+/**
+ * Asynchronous lookups setup
+ *
+ * Creates the job queue and starts the worker threads.
+ *
+ * @param pool Module memory pool
+ * @return Whether or not we succeeded setting up asynchronous lookups
+ */
+switch_status_t pn_async_init(switch_memory_pool_t *pool)
+{
+  switch_threadattr_t *thd_attr = NULL;
+  uint32_t i;
+
+  if (!mod_phonenumber_async_workers) {
+    return SWITCH_STATUS_SUCCESS;
+  }
+
+  if (mod_phonenumber_async_workers > PN_ASYNC_MAX_WORKERS) {
+    mod_phonenumber_async_workers = PN_ASYNC_MAX_WORKERS;
+  }
+
+  if (!mod_phonenumber_async_queue_size) {
+    mod_phonenumber_async_queue_size = PN_ASYNC_DEFAULT_QUEUE_SIZE;
+  }
+
+  if (switch_event_reserve_subclass(PN_EVENT_RESULT) != SWITCH_STATUS_SUCCESS) {
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Cannot register subclass %s\n", PN_EVENT_RESULT);
+    return SWITCH_STATUS_TERM;
+  }
+
+  /* Room for the shutdown sentinels on top of the configured capacity */
+  switch_queue_create(&mod_phonenumber_async_queue, mod_phonenumber_async_queue_size + mod_phonenumber_async_workers, pool);
+
+  switch_threadattr_create(&thd_attr, pool);
+  switch_threadattr_stacksize_set(thd_attr, SWITCH_THREAD_STACKSIZE);
+
+  for (i = 0; i < mod_phonenumber_async_workers; i++) {
+    if (switch_thread_create(&mod_phonenumber_async_threads[i], thd_attr, pn_async_worker, NULL, pool) != SWITCH_STATUS_SUCCESS) {
+      switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Cannot start asynchronous lookup worker\n");
+      break;
+    }
+  }
+
+  mod_phonenumber_async_running = i;
+
+  if (!mod_phonenumber_async_running) {
+    return SWITCH_STATUS_TERM;
+  }
+
+  switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Started %u asynchronous lookup workers, queue size %u\n", mod_phonenumber_async_running,
+                    mod_phonenumber_async_queue_size);
+
+  return SWITCH_STATUS_SUCCESS;
+}
+
+/**
+ * Asynchronous lookups teardown
+ *
+ * Stops the workers once they finished their current jobs; whatever is still
+ * queued is dropped.
+ */
+void pn_async_destroy()
+{
+  switch_status_t status;
+  void *pop = NULL;
+  uint32_t i;
+
+  if (!mod_phonenumber_async_queue) {
+    return;
+  }
+
+  for (i = 0; i < mod_phonenumber_async_running; i++) {
+    switch_queue_push(mod_phonenumber_async_queue, NULL);
+  }
+
+  for (i = 0; i < mod_phonenumber_async_running; i++) {
+    switch_thread_join(&status, mod_phonenumber_async_threads[i]);
+  }
+
+  while (switch_queue_trypop(mod_phonenumber_async_queue, &pop) == SWITCH_STATUS_SUCCESS) {
+    if (pop) {
+      pn_async_job_free((phonenumber_job_t *)pop);
+    }
+  }
+
+  mod_phonenumber_async_running = 0;
+  mod_phonenumber_async_queue = NULL;
+
+  switch_event_free_subclass(PN_EVENT_RESULT);
+}
+
+/**
+ * Job submission
+ *
+ * Queues a lookup and immediately reports its job UUID, or the back-pressure
+ * condition when the queue is full.
+ *
+ * @param actions Comma separated actions
+ * @param number Number to look up
+ * @param config Optional configuration string
+ * @param stream Output stream
+ */
+void pn_async_submit(const char *actions, const char *number, const char *config, switch_stream_handle_t *stream)
+{
+  phonenumber_job_t *job;
+  char uuid[SWITCH_UUID_FORMATTED_LENGTH + 1];
+
+  if (!mod_phonenumber_async_queue) {
+    stream->write_function(stream, "-ERR: Asynchronous lookups are disabled (async_workers is 0)\n");
+    return;
+  }
+
+  if (!(job = (phonenumber_job_t *)malloc(sizeof(phonenumber_job_t)))) {
+    stream->write_function(stream, "-ERR: Cannot create job, possibly OOM!\n");
+    return;
+  }
+
+  switch_uuid_str(job->uuid, sizeof(job->uuid));
+  switch_copy_string(uuid, job->uuid, sizeof(uuid));
+  switch_strdup(job->actions, actions);
+  switch_strdup(job->number, number);
+  job->config = NULL;
+  if (!zstr(config)) {
+    switch_strdup(job->config, config);
+  }
+
+  if (switch_queue_size(mod_phonenumber_async_queue) >= mod_phonenumber_async_queue_size ||
+      switch_queue_trypush(mod_phonenumber_async_queue, job) != SWITCH_STATUS_SUCCESS) {
+    stream->write_function(stream, "-ERR: Queue full (%u jobs pending)\n", switch_queue_size(mod_phonenumber_async_queue));
+    pn_async_job_free(job);
+    return;
+  }
+
+  /* The job belongs to the workers from now on */
+  stream->write_function(stream, "+OK %s\n", uuid);
+}
@@ -0,0 +1,522 @@
+/*
+ * Copyright (c) 2019 Ciprian Dosoftei
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <set>
+
+using namespace std;
+
+#include "phonenumbers/phonenumber.pb.h"
+#include "phonenumbers/phonenumberutil.h"
+
+using i18n::phonenumbers::PhoneNumber;
+using i18n::phonenumbers::PhoneNumberUtil;
+
+#include "mod_phonenumber.h"
+
+/**
+ * Shared lookup cache
+ *
+ * Open-addressed hash table living in a memory mapping, either backed by a
+ * file (typically under /dev/shm, so all the FreeSWITCH instances on the host
+ * share it) or anonymous (private to this process). Slots are published with
+ * a per-slot sequence number (odd while the slot is being written), so
+ * readers never take a lock and writers only contend on the slot they update;
+ * a writer which cannot claim a slot simply skips caching the result.
+ */
+static phonenumber_cache_header_t *mod_phonenumber_cache = NULL;
+static phonenumber_cache_slot_t *mod_phonenumber_cache_slots = NULL;
+static size_t mod_phonenumber_cache_length = 0;
+static uint32_t mod_phonenumber_cache_mask = 0;
+static uint64_t mod_phonenumber_cache_fingerprint = 0;
+
+/**
+ * Cache configuration
+ *
+ * Number of slots (0 disables the cache) and backing file path (anonymous
+ * mapping if not set), as defined in phonenumber.conf.xml.
+ */
+uint32_t mod_phonenumber_cache_size = 0;
+char *mod_phonenumber_cache_path = NULL;
+
+/**
+ * Mapping length
+ *
+ * @param slots Number of slots
+ * @return Size of the header followed by the slots, in bytes
+ */
+static size_t pn_cache_length(uint32_t slots)
+{
+  return ((sizeof(phonenumber_cache_header_t) + 63) & ~(size_t)63) + ((size_t)slots * sizeof(phonenumber_cache_slot_t));
+}
+
+/**
+ * Version fingerprint
+ *
+ * Results are only valid for the module and libphonenumber metadata versions
+ * which produced them. libphonenumber does not expose its metadata version,
+ * so it is inferred from the example numbers of every supported region; the
+ * fingerprint is mixed into every slot hash, hence entries written by other
+ * versions are never matched.
+ *
+ * @return Fingerprint of the running module/metadata combination
+ */
+uint64_t pn_cache_fingerprint()
+{
+  set<string> regions;
+  string examples = PN_VERSION;
+  string formatted;
+  PhoneNumber number;
+
+  if (mod_phonenumber_cache_fingerprint) {
+    return mod_phonenumber_cache_fingerprint;
+  }
+
+  phone_util.GetSupportedRegions(&regions);
+
+  for (set<string>::iterator region = regions.begin(); region != regions.end(); ++region) {
+    examples += "|" + *region;
+
+    if (phone_util.GetExampleNumberForType(*region, PhoneNumberUtil::FIXED_LINE, &number)) {
+      phone_util.Format(number, PhoneNumberUtil::E164, &formatted);
+      examples += ":" + formatted;
+    }
+
+    if (phone_util.GetExampleNumberForType(*region, PhoneNumberUtil::MOBILE, &number)) {
+      phone_util.Format(number, PhoneNumberUtil::E164, &formatted);
+      examples += ":" + formatted;
+    }
+  }
+
+  mod_phonenumber_cache_fingerprint = pn_util_hash(examples.c_str()) | 1;
+
+  return mod_phonenumber_cache_fingerprint;
+}
+
+/**
+ * Cache header setup
+ *
+ * @param header Header to (re)initialize
+ * @param slots Number of slots
+ */
+static void pn_cache_header_init(phonenumber_cache_header_t *header, uint32_t slots)
+{
+  header->slots = slots;
+  header->fingerprint = pn_cache_fingerprint();
+  switch_copy_string(header->version, PN_VERSION, sizeof(header->version));
+  header->hits.store(0, memory_order_relaxed);
+  header->misses.store(0, memory_order_relaxed);
+  header->magic = PN_CACHE_MAGIC;
+}
+
+/**
+ * Cache file mapping
+ *
+ * Maps (creating it if needed) the shared cache file. Concurrent loaders are
+ * serialized with an exclusive lock on the file; an existing file is never
+ * resized, since other processes may have it mapped, so its slot count wins
+ * over the local configuration. A header written by another module or
+ * metadata version is taken over, which leaves the older entries
+ * unreachable.
+ *
+ * @param path Cache file path
+ * @param slots Desired number of slots
+ * @return Mapped header, or NULL on failure
+ */
+static phonenumber_cache_header_t *pn_cache_map_file(const char *path, uint32_t slots)
+{
+  phonenumber_cache_header_t *header = NULL;
+  struct stat st;
+  size_t length = pn_cache_length(slots);
+  void *map = MAP_FAILED;
+  int fd;
+
+  if ((fd = open(path, O_RDWR | O_CREAT, 0660)) < 0) {
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Cannot open cache file %s\n", path);
+    return NULL;
+  }
+
+  if (flock(fd, LOCK_EX) || fstat(fd, &st)) {
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Cannot lock cache file %s\n", path);
+    goto done;
+  }
+
+  if (!st.st_size) {
+    if (ftruncate(fd, length)) {
+      switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Cannot size cache file %s\n", path);
+      goto done;
+    }
+  } else if ((size_t)st.st_size >= sizeof(phonenumber_cache_header_t)) {
+    phonenumber_cache_header_t existing;
+
+    if ((pread(fd, &existing, sizeof(existing), 0) != sizeof(existing)) || (existing.magic != PN_CACHE_MAGIC) ||
+        ((size_t)st.st_size != pn_cache_length(existing.slots))) {
+      switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Unrecognized cache file %s\n", path);
+      goto done;
+    }
+
+    slots = existing.slots;
+    length = st.st_size;
+  } else {
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Unrecognized cache file %s\n", path);
+    goto done;
+  }
+
+  if ((map = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Cannot map cache file %s\n", path);
+    goto done;
+  }
+
+  header = (phonenumber_cache_header_t *)map;
+
+  if ((header->magic != PN_CACHE_MAGIC) || (header->fingerprint != pn_cache_fingerprint()) || strncmp(header->version, PN_VERSION, sizeof(header->version))) {
+    if (header->magic == PN_CACHE_MAGIC) {
+      switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "Cache file %s written by version %.*s, taking it over\n", path, PN_CACHE_VERSION_LEN, header->version);
+    }
+
+    pn_cache_header_init(header, slots);
+  }
+
+  mod_phonenumber_cache_length = length;
+
+done:
+  flock(fd, LOCK_UN);
+  close(fd);
+
+  return header;
+}
+
+/**
+ * Cache setup
+ *
+ * Maps the cache, rounding its size up to the next power of two.
+ *
+ * @return Whether or not we succeeded setting up the cache
+ */
+switch_status_t pn_cache_init()
+{
+  uint32_t size = 1;
+  void *map;
+
+  if (!mod_phonenumber_cache_size) {
+    return SWITCH_STATUS_SUCCESS;
+  }
+
+  if (mod_phonenumber_cache_size > PN_CACHE_MAX_SIZE) {
+    mod_phonenumber_cache_size = PN_CACHE_MAX_SIZE;
+  }
+
+  while (size < mod_phonenumber_cache_size) {
+    size <<= 1;
+  }
+
+  if (!zstr(mod_phonenumber_cache_path)) {
+    mod_phonenumber_cache = pn_cache_map_file(mod_phonenumber_cache_path, size);
+  } else {
+    mod_phonenumber_cache_length = pn_cache_length(size);
+
+    if ((map = mmap(NULL, mod_phonenumber_cache_length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0)) != MAP_FAILED) {
+      mod_phonenumber_cache = (phonenumber_cache_header_t *)map;
+      pn_cache_header_init(mod_phonenumber_cache, size);
+    }
+  }
+
+  if (!mod_phonenumber_cache) {
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Cannot set up lookup cache\n");
+    mod_phonenumber_cache_size = 0;
+    mod_phonenumber_cache_length = 0;
+    return SWITCH_STATUS_TERM;
+  }
+
+  mod_phonenumber_cache_size = mod_phonenumber_cache->slots;
+  mod_phonenumber_cache_mask = mod_phonenumber_cache_size - 1;
+  mod_phonenumber_cache_slots = (phonenumber_cache_slot_t *)((char *)mod_phonenumber_cache + pn_cache_length(0));
+
+  switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Configured %s lookup cache with %u slots\n", zstr(mod_phonenumber_cache_path) ? "private" : "shared",
+                    mod_phonenumber_cache_size);
+
+  return SWITCH_STATUS_SUCCESS;
+}
+
+/**
+ * Cache teardown
+ */
+void pn_cache_destroy()
+{
+  if (mod_phonenumber_cache) {
+    munmap(mod_phonenumber_cache, mod_phonenumber_cache_length);
+    mod_phonenumber_cache = NULL;
+    mod_phonenumber_cache_slots = NULL;
+  }
+
+  mod_phonenumber_cache_size = 0;
+  mod_phonenumber_cache_length = 0;
+  switch_safe_free(mod_phonenumber_cache_path);
+}
+
+/**
+ * Whether or not the cache is usable; another module or metadata version may
+ * have taken over the shared file in the meantime.
+ */
+bool pn_cache_enabled()
+{
+  return mod_phonenumber_cache && (mod_phonenumber_cache->fingerprint == mod_phonenumber_cache_fingerprint);
+}
+
+/**
+ * Cache key builder
+ *
+ * Combines the request's input, stripped of the visual separators the parser
+ * ignores anyway (only for inputs without letters, which may carry extension
+ * markers), with its configuration.
+ *
+ * @param request Request
+ * @param key Buffer of PN_CACHE_KEY_LEN bytes
+ * @return Whether or not the request can be cached (i.e. the key fits)
+ */
+bool pn_cache_key(phonenumber_request_t *request, char *key)
+{
+  const char *c;
+  size_t length = 0;
+  bool letters = false;
+  int written;
+
+  for (c = request->number; *c; c++) {
+    if (((*c >= 'a') && (*c <= 'z')) || ((*c >= 'A') && (*c <= 'Z'))) {
+      letters = true;
+      break;
+    }
+  }
+
+  for (c = request->number; *c; c++) {
+    if (!letters && strchr(" -.()", *c)) {
+      continue;
+    }
+
+    if (length >= PN_CACHE_KEY_LEN - 1) {
+      return false;
+    }
+
+    key[length++] = *c;
+  }
+
+  written = snprintf(key + length, PN_CACHE_KEY_LEN - length, "|%s%d%s%s%s", request->config->default_region, (int)request->config->format, request->config->locale,
+                     request->config->calling_from, request->config->candidates);
+
+  return (written > 0) && ((size_t)written < PN_CACHE_KEY_LEN - length);
+}
+
+/**
+ * Slot hash
+ *
+ * @param key Cache key
+ * @param action Action identifier
+ * @return Non-zero hash, bound to the running version fingerprint
+ */
+static uint64_t pn_cache_hash(const char *key, phonenumber_action_id action)
+{
+  uint64_t hash = (pn_util_hash(key) ^ mod_phonenumber_cache_fingerprint) + ((uint64_t)action * 0x9e3779b97f4a7c15ULL);
+
+  hash ^= hash >> 31;
+
+  return hash ? hash : 1;
+}
+
+/**
+ * Cache lookup
+ *
+ * @param key Cache key (see pn_cache_key)
+ * @param action Action identifier
+ * @param capture Receives the cached result on hits
+ * @return Whether or not the result was found
+ */
+bool pn_cache_get(const char *key, phonenumber_action_id action, phonenumber_capture_t *capture)
+{
+  uint64_t hash = pn_cache_hash(key, action);
+  phonenumber_cache_slot_t *slot;
+  char slot_key[PN_CACHE_KEY_LEN];
+  uint32_t seq, i;
+
+  for (i = 0; i < PN_CACHE_PROBE; i++) {
+    slot = &mod_phonenumber_cache_slots[(hash + i) & mod_phonenumber_cache_mask];
+
+    seq = slot->seq.load(memory_order_acquire);
+    if ((seq & 1) || (slot->hash != hash) || (slot->action != action)) {
+      continue;
+    }
+
+    memcpy(slot_key, slot->key, sizeof(slot_key));
+    memcpy(capture->suffix, slot->suffix, sizeof(capture->suffix));
+    memcpy(capture->value, slot->value, sizeof(capture->value));
+
+    atomic_thread_fence(memory_order_acquire);
+    if (slot->seq.load(memory_order_relaxed) != seq) {
+      continue;
+    }
+
+    slot_key[PN_CACHE_KEY_LEN - 1] = '\0';
+    if (strcmp(slot_key, key)) {
+      continue;
+    }
+
+    capture->suffix[PN_CACHE_SUFFIX_LEN - 1] = '\0';
+    capture->value[PN_CACHE_VALUE_LEN - 1] = '\0';
+    capture->set = true;
+    capture->overflow = false;
+
+    slot->hits.fetch_add(1, memory_order_relaxed);
+    mod_phonenumber_cache->hits.fetch_add(1, memory_order_relaxed);
+
+    return true;
+  }
+
+  mod_phonenumber_cache->misses.fetch_add(1, memory_order_relaxed);
+
+  return false;
+}
+
+/**
+ * Cache insertion
+ *
+ * Stores the result in the first free (or same key) slot of the probe
+ * window; when the window is full, the least used slot is replaced and the
+ * others age, so entries which went cold (or were written by another
+ * version) eventually make room.
+ *
+ * @param key Cache key (see pn_cache_key)
+ * @param action Action identifier
+ * @param capture Result emitted by the action
+ */
+void pn_cache_put(const char *key, phonenumber_action_id action, phonenumber_capture_t *capture)
+{
+  uint64_t hash = pn_cache_hash(key, action);
+  phonenumber_cache_slot_t *slot, *victim = NULL;
+  uint32_t seq, hits, least = UINT32_MAX, i;
+
+  if (!capture->set || capture->overflow) {
+    return;
+  }
+
+  for (i = 0; i < PN_CACHE_PROBE; i++) {
+    slot = &mod_phonenumber_cache_slots[(hash + i) & mod_phonenumber_cache_mask];
+
+    if (!slot->hash || (slot->hash == hash)) {
+      victim = slot;
+      break;
+    }
+
+    hits = slot->hits.load(memory_order_relaxed);
+    slot->hits.store(hits >> 1, memory_order_relaxed);
+
+    if (hits < least) {
+      least = hits;
+      victim = slot;
+    }
+  }
+
+  seq = victim->seq.load(memory_order_relaxed);
+  if ((seq & 1) || !victim->seq.compare_exchange_strong(seq, seq + 1, memory_order_acquire)) {
+    return;
+  }
+
+  atomic_thread_fence(memory_order_release);
+
+  victim->hash = hash;
+  victim->action = (uint8_t)action;
+  switch_copy_string(victim->key, key, sizeof(victim->key));
+  switch_copy_string(victim->suffix, capture->suffix, sizeof(victim->suffix));
+  switch_copy_string(victim->value, capture->value, sizeof(victim->value));
+  victim->hits.store(0, memory_order_relaxed);
+
+  victim->seq.store(seq + 2, memory_order_release);
+}
+
+/**
+ * Cache slot reader
+ *
+ * Takes a consistent copy of a slot, provided it holds a result produced by
+ * the running module/metadata version.
+ *
+ * @param index Slot index
+ * @param action Receives the action identifier
+ * @param key Receives the cache key (PN_CACHE_KEY_LEN bytes)
+ * @param capture Receives the result
+ * @param hits Receives the slot's hit counter
+ * @return Whether or not the slot holds a usable result
+ */
+bool pn_cache_read_slot(uint32_t index, phonenumber_action_id *action, char *key, phonenumber_capture_t *capture, uint32_t *hits)
+{
+  phonenumber_cache_slot_t *slot = &mod_phonenumber_cache_slots[index & mod_phonenumber_cache_mask];
+  uint64_t hash;
+  uint32_t seq;
+  uint8_t id;
+
+  seq = slot->seq.load(memory_order_acquire);
+  if ((seq & 1) || !slot->hash) {
+    return false;
+  }
+
+  hash = slot->hash;
+  id = slot->action;
+  memcpy(key, slot->key, PN_CACHE_KEY_LEN);
+  memcpy(capture->suffix, slot->suffix, sizeof(capture->suffix));
+  memcpy(capture->value, slot->value, sizeof(capture->value));
+  *hits = slot->hits.load(memory_order_relaxed);
+
+  atomic_thread_fence(memory_order_acquire);
+  if (slot->seq.load(memory_order_relaxed) != seq) {
+    return false;
+  }
+
+  key[PN_CACHE_KEY_LEN - 1] = '\0';
+  capture->suffix[PN_CACHE_SUFFIX_LEN - 1] = '\0';
+  capture->value[PN_CACHE_VALUE_LEN - 1] = '\0';
+  capture->set = true;
+  capture->overflow = false;
+  *action = (phonenumber_action_id)id;
+
+  return (id < phonenumber_action_id::ACTION_UNKNOWN) && (pn_cache_hash(key, *action) == hash);
+}
+
+/**
+ * Cache statistics
+ *
+ * @param stream Output stream
+ */
+void pn_cache_stats(switch_stream_handle_t *stream)
+{
+  if (!mod_phonenumber_cache) {
+    stream->write_function(stream, "-ERR: Caching is disabled (cache_size is 0)\n");
+    return;
+  }
+
+  stream->write_function(stream, "+OK %s slots=%u hits=%" PRIu64 " misses=%" PRIu64 "%s\n", zstr(mod_phonenumber_cache_path) ? "private" : "shared",
+                         mod_phonenumber_cache_size, mod_phonenumber_cache->hits.load(memory_order_relaxed), mod_phonenumber_cache->misses.load(memory_order_relaxed),
+                         pn_cache_enabled() ? "" : " (taken over by another version)");
+}
@@ -0,0 +1,391 @@
+/*
+ * Copyright (c) 2019 Ciprian Dosoftei
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+using namespace std;
+
+#include "mod_phonenumber.h"
+
+/**
+ * Membership lists
+ *
+ * Every list is compiled from its text file into a single read-only anonymous
+ * mapping: a Bloom filter followed by the sorted, deduplicated entries. Most
+ * lookups are misses and are settled by the filter alone; possible hits are
+ * confirmed by a binary search. Reloads compile a complete new set of lists
+ * before swapping it in under the write lock, so lookups never observe a
+ * partially loaded list.
+ */
+phonenumber_list_t *mod_phonenumber_lists = NULL;
+static switch_thread_rwlock_t *mod_phonenumber_lists_lock = NULL;
+static switch_mutex_t *mod_phonenumber_lists_reload_mutex = NULL;
+
+/**
+ * Bloom filter hash
+ *
+ * @param packed Packed number
+ * @return Well mixed 64-bit hash of the packed number
+ */
+static inline uint64_t pn_list_mix(uint64_t packed)
+{
+  packed ^= packed >> 30;
+  packed *= 0xbf58476d1ce4e5b9ULL;
+  packed ^= packed >> 27;
+  packed *= 0x94d049bb133111ebULL;
+  packed ^= packed >> 31;
+
+  return packed;
+}
+
+/**
+ * Entry comparator (qsort/bsearch)
+ */
+static int pn_list_compare(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+  return (x > y) - (x < y);
+}
+
+/**
+ * Number packer
+ *
+ * Packs an E.164 number (with or without the leading +, visual separators
+ * are skipped) into an integer; since country calling codes never start with
+ * 0, distinct numbers always yield distinct values.
+ *
+ * @param number Number to pack
+ * @param packed Packed number
+ * @return Whether or not the input is a packable E.164 number
+ */
+bool pn_list_pack(const char *number, uint64_t *packed)
+{
+  uint64_t value = 0;
+  int digits = 0;
+
+  if (*number == '+') {
+    number++;
+  }
+
+  for (; *number; number++) {
+    if ((*number >= '0') && (*number <= '9')) {
+      if (++digits > PN_LIST_MAX_DIGITS) {
+        return false;
+      }
+
+      value = (value * 10) + (*number - '0');
+    } else if (!strchr(" -.()", *number)) {
+      break;
+    }
+  }
+
+  if (!value) {
+    return false;
+  }
+
+  *packed = value;
+
+  return true;
+}
+
+/**
+ * List compiler
+ *
+ * Reads the list's file (one E.164 number per line, # starts a comment) and
+ * builds its mapping.
+ *
+ * @param list List to load
+ * @return Whether or not we succeeded loading the list
+ */
+static switch_status_t pn_list_load(phonenumber_list_t *list)
+{
+  FILE *file;
+  char line[256], *p;
+  uint64_t *entries = NULL, *grown, packed, bits = 64, hash, step;
+  size_t count = 0, size = 0, i, j, unique = 0, bloom_length;
+  uint32_t lineno = 0, k;
+
+  if (!(file = fopen(list->path, "r"))) {
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Cannot open list %s file %s\n", list->name, list->path);
+    return SWITCH_STATUS_FALSE;
+  }
+
+  while (fgets(line, sizeof(line), file)) {
+    lineno++;
+
+    for (p = line; (*p == ' ') || (*p == '\t'); p++)
+      ;
+
+    if (!*p || (*p == '#') || (*p == '\r') || (*p == '\n')) {
+      continue;
+    }
+
+    if (!pn_list_pack(p, &packed)) {
+      switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Ignoring invalid entry in list %s (%s:%u)\n", list->name, list->path, lineno);
+      continue;
+    }
+
+    if (count == size) {
+      size = size ? (size * 2) : 1024;
+
+      if (!(grown = (uint64_t *)realloc(entries, size * sizeof(uint64_t)))) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_CRIT, "Cannot load list %s, possibly OOM!\n", list->name);
+        switch_safe_free(entries);
+        fclose(file);
+        return SWITCH_STATUS_FALSE;
+      }
+
+      entries = grown;
+    }
+
+    entries[count++] = packed;
+  }
+
+  fclose(file);
+
+  if (count) {
+    qsort(entries, count, sizeof(uint64_t), pn_list_compare);
+
+    for (i = 0; i < count; i++) {
+      if (!unique || (entries[i] != entries[unique - 1])) {
+        entries[unique++] = entries[i];
+      }
+    }
+  }
+
+  while (bits < (uint64_t)unique * PN_LIST_BLOOM_BITS) {
+    bits <<= 1;
+  }
+
+  bloom_length = bits / 8;
+  list->length = bloom_length + (unique * sizeof(uint64_t));
+  list->map = mmap(NULL, list->length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+  if (list->map == MAP_FAILED) {
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Cannot map list %s (%zu bytes)\n", list->name, list->length);
+    list->map = NULL;
+    switch_safe_free(entries);
+    return SWITCH_STATUS_FALSE;
+  }
+
+  list->bloom = (uint64_t *)list->map;
+  list->bloom_mask = bits - 1;
+  list->entries = (uint64_t *)((char *)list->map + bloom_length);
+  list->count = unique;
+
+  if (unique) {
+    memcpy(list->entries, entries, unique * sizeof(uint64_t));
+  }
+
+  for (j = 0; j < unique; j++) {
+    hash = pn_list_mix(list->entries[j]);
+    step = pn_list_mix(hash) | 1;
+
+    for (k = 0; k < PN_LIST_BLOOM_HASHES; k++, hash += step) {
+      list->bloom[(hash & list->bloom_mask) >> 6] |= 1ULL << (hash & 63);
+    }
+  }
+
+  mprotect(list->map, list->length, PROT_READ);
+  switch_safe_free(entries);
+
+  switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "Loaded list %s: %zu entries (%zu ignored duplicates), %zu bytes\n", list->name, unique, count - unique,
+                    list->length);
+
+  return SWITCH_STATUS_SUCCESS;
+}
+
+/**
+ * List set cleanup
+ *
+ * @param lists Lists to release
+ */
+static void pn_list_free(phonenumber_list_t *lists)
+{
+  phonenumber_list_t *next;
+
+  while (lists) {
+    next = lists->next;
+
+    if (lists->map) {
+      munmap(lists->map, lists->length);
+    }
+
+    switch_safe_free(lists->path);
+    free(lists);
+    lists = next;
+  }
+}
+
+/**
+ * Membership lists setup
+ *
+ * Loads the lists defined in phonenumber.conf.xml; a list which cannot be
+ * loaded stays empty (and can be fixed by a later reload).
+ *
+ * @param pool Module memory pool
+ * @return Whether or not we succeeded setting up the lists
+ */
+switch_status_t pn_list_init(switch_memory_pool_t *pool)
+{
+  phonenumber_list_t *list;
+
+  switch_thread_rwlock_create(&mod_phonenumber_lists_lock, pool);
+  switch_mutex_init(&mod_phonenumber_lists_reload_mutex, SWITCH_MUTEX_NESTED, pool);
+
+  for (list = mod_phonenumber_lists; list; list = list->next) {
+    pn_list_load(list);
+  }
+
+  return SWITCH_STATUS_SUCCESS;
+}
+
+/**
+ * Membership lists teardown
+ */
+void pn_list_destroy()
+{
+  if (mod_phonenumber_lists_lock) {
+    switch_thread_rwlock_wrlock(mod_phonenumber_lists_lock);
+  }
+
+  pn_list_free(mod_phonenumber_lists);
+  mod_phonenumber_lists = NULL;
+
+  if (mod_phonenumber_lists_lock) {
+    switch_thread_rwlock_unlock(mod_phonenumber_lists_lock);
+  }
+}
+
+/**
+ * Membership lists reload
+ *
+ * Recompiles every list from its file, then atomically replaces the current
+ * set; if any list fails to load, the current set is kept.
+ *
+ * @param stream Output stream
+ * @return Whether or not the lists were replaced
+ */
+switch_status_t pn_list_reload(switch_stream_handle_t *stream)
+{
+  phonenumber_list_t *fresh = NULL, *tail = NULL, *list, *copy, *stale;
+  size_t entries = 0;
+  uint32_t count = 0;
+
+  switch_mutex_lock(mod_phonenumber_lists_reload_mutex);
+
+  for (list = mod_phonenumber_lists; list; list = list->next) {
+    if (!(copy = (phonenumber_list_t *)calloc(1, sizeof(phonenumber_list_t)))) {
+      stream->write_function(stream, "-ERR: Cannot reload lists, possibly OOM!\n");
+      pn_list_free(fresh);
+      switch_mutex_unlock(mod_phonenumber_lists_reload_mutex);
+      return SWITCH_STATUS_FALSE;
+    }
+
+    switch_copy_string(copy->name, list->name, sizeof(copy->name));
+    switch_strdup(copy->path, list->path);
+
+    if (tail) {
+      tail->next = copy;
+    } else {
+      fresh = copy;
+    }
+    tail = copy;
+
+    if (pn_list_load(copy) != SWITCH_STATUS_SUCCESS) {
+      stream->write_function(stream, "-ERR: Cannot load list %s from %s\n", copy->name, copy->path);
+      pn_list_free(fresh);
+      switch_mutex_unlock(mod_phonenumber_lists_reload_mutex);
+      return SWITCH_STATUS_FALSE;
+    }
+
+    entries += copy->count;
+    count++;
+  }
+
+  switch_thread_rwlock_wrlock(mod_phonenumber_lists_lock);
+  stale = mod_phonenumber_lists;
+  mod_phonenumber_lists = fresh;
+  switch_thread_rwlock_unlock(mod_phonenumber_lists_lock);
+
+  pn_list_free(stale);
+
+  switch_mutex_unlock(mod_phonenumber_lists_reload_mutex);
+
+  stream->write_function(stream, "+OK %u lists, %zu entries\n", count, entries);
+
+  return SWITCH_STATUS_SUCCESS;
+}
+
+/**
+ * Membership test
+ *
+ * @param name List name, all the lists are checked if empty
+ * @param packed Packed number (see pn_list_pack)
+ * @return Whether or not the number is listed
+ */
+bool pn_list_contains(const char *name, uint64_t packed)
+{
+  phonenumber_list_t *list;
+  uint64_t hash, step;
+  bool listed = false, known = false;
+  uint32_t k;
+
+  switch_thread_rwlock_rdlock(mod_phonenumber_lists_lock);
+
+  for (list = mod_phonenumber_lists; list && !listed; list = list->next) {
+    if (!zstr(name) && strcmp(name, list->name)) {
+      continue;
+    }
+
+    known = true;
+
+    if (!list->count) {
+      continue;
+    }
+
+    hash = pn_list_mix(packed);
+    step = pn_list_mix(hash) | 1;
+
+    for (k = 0; k < PN_LIST_BLOOM_HASHES; k++, hash += step) {
+      if (!(list->bloom[(hash & list->bloom_mask) >> 6] & (1ULL << (hash & 63)))) {
+        break;
+      }
+    }
+
+    if (k == PN_LIST_BLOOM_HASHES) {
+      listed = bsearch(&packed, list->entries, list->count, sizeof(uint64_t), pn_list_compare) != NULL;
+    }
+  }
+
+  switch_thread_rwlock_unlock(mod_phonenumber_lists_lock);
+
+  if (!known && !zstr(name)) {
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Unknown list %s\n", name);
+  }
+
+  return listed;
+}
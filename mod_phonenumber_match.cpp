@@ -0,0 +1,328 @@
+/*
+ * Copyright (c) 2019 Ciprian Dosoftei
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+
+using namespace std;
+
+#include "mod_phonenumber.h"
+
+/**
+ * Hook predicates
+ *
+ * The caller_prefix/destination_prefix parameters of all the hooks are
+ * compiled into one trie per scope, every node carrying the mask of the
+ * hooks whose prefix ends there, so a single walk over a number yields all
+ * the hooks it applies to. match_variable conditions are grouped by variable
+ * name, hence every variable is fetched once per channel regardless of the
+ * number of hooks referring to it. Hooks without constraints of a given kind
+ * are always part of the corresponding mask.
+ */
+static phonenumber_trie_t mod_phonenumber_match_caller = { NULL, 0, 0, 0 };
+static phonenumber_trie_t mod_phonenumber_match_destination = { NULL, 0, 0, 0 };
+static phonenumber_match_variable_t *mod_phonenumber_match_variables = NULL;
+static switch_hash_t *mod_phonenumber_match_variables_index = NULL;
+
+/**
+ * Trie branch
+ *
+ * @param c Number character
+ * @return Child slot for the character, -1 if it cannot be part of a prefix
+ */
+static inline int pn_match_branch(char c)
+{
+  if ((c >= '0') && (c <= '9')) {
+    return c - '0';
+  }
+
+  return (c == '+') ? 10 : -1;
+}
+
+/**
+ * Trie node allocator
+ *
+ * @param trie Trie to grow
+ * @return Index of the new node, 0 on failure (0 is the root, never a child)
+ */
+static uint32_t pn_match_node(phonenumber_trie_t *trie)
+{
+  phonenumber_trie_node_t *nodes;
+
+  if (trie->count == trie->size) {
+    if (!(nodes = (phonenumber_trie_node_t *)realloc(trie->nodes, (trie->size ? trie->size * 2 : 64) * sizeof(phonenumber_trie_node_t)))) {
+      return 0;
+    }
+
+    trie->nodes = nodes;
+    trie->size = trie->size ? trie->size * 2 : 64;
+  }
+
+  memset(&trie->nodes[trie->count], 0, sizeof(phonenumber_trie_node_t));
+
+  return trie->count++;
+}
+
+/**
+ * Hook registration
+ *
+ * Declares a hook as unconstrained until prefixes are added for it.
+ *
+ * @param bit Hook bit
+ */
+void pn_match_hook(uint64_t bit)
+{
+  mod_phonenumber_match_caller.any |= bit;
+  mod_phonenumber_match_destination.any |= bit;
+}
+
+/**
+ * Prefix constraint
+ *
+ * @param scope Number the prefixes apply to (caller or destination)
+ * @param prefixes PN_MATCH_SEPARATOR separated prefixes, e.g. "+44|0044"
+ * @param bit Hook bit
+ * @return Whether or not all the prefixes are valid
+ */
+bool pn_match_add_prefixes(phonenumber_scope scope, const char *prefixes, uint64_t bit)
+{
+  phonenumber_trie_t *trie = (scope == phonenumber_scope::SCOPE_CALLER) ? &mod_phonenumber_match_caller : &mod_phonenumber_match_destination;
+  uint32_t node, child, digits = 0;
+  const char *p;
+  int branch;
+
+  if (zstr(prefixes)) {
+    return false;
+  }
+
+  /* Validate everything first, so a bad value leaves the trie untouched */
+  for (p = prefixes; *p; p++) {
+    if (*p == PN_MATCH_SEPARATOR) {
+      continue;
+    }
+
+    if (pn_match_branch(*p) < 0) {
+      return false;
+    }
+
+    digits++;
+  }
+
+  if (!digits) {
+    return false;
+  }
+
+  if (!trie->count) {
+    pn_match_node(trie);
+
+    if (!trie->count) {
+      return false;
+    }
+  }
+
+  trie->any &= ~bit;
+
+  for (p = prefixes; *p;) {
+    for (node = 0; *p && (*p != PN_MATCH_SEPARATOR); p++) {
+      branch = pn_match_branch(*p);
+
+      if (!(child = trie->nodes[node].children[branch])) {
+        if (!(child = pn_match_node(trie))) {
+          switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_CRIT, "Cannot grow prefix trie, possibly OOM!\n");
+          return false;
+        }
+
+        trie->nodes[node].children[branch] = child;
+      }
+
+      node = child;
+    }
+
+    if (node) {
+      trie->nodes[node].hooks |= bit;
+    }
+
+    if (*p == PN_MATCH_SEPARATOR) {
+      p++;
+    }
+  }
+
+  return true;
+}
+
+/**
+ * Channel variable constraint
+ *
+ * Conditions on the same variable are alternatives, conditions on distinct
+ * variables must all hold.
+ *
+ * @param condition Condition as <variable>=<value>
+ * @param bit Hook bit
+ * @return Whether or not the condition is valid
+ */
+bool pn_match_add_variable(const char *condition, uint64_t bit)
+{
+  phonenumber_match_variable_t *variable;
+  phonenumber_match_value_t *value;
+  const char *eq = strchr(condition, '=');
+  char *name;
+
+  if (!eq || (eq == condition)) {
+    return false;
+  }
+
+  if (!mod_phonenumber_match_variables_index) {
+    switch_core_hash_init(&mod_phonenumber_match_variables_index);
+  }
+
+  name = strndup(condition, eq - condition);
+
+  if (!(variable = (phonenumber_match_variable_t *)switch_core_hash_find(mod_phonenumber_match_variables_index, name))) {
+    if (!(variable = (phonenumber_match_variable_t *)calloc(1, sizeof(phonenumber_match_variable_t)))) {
+      switch_safe_free(name);
+      return false;
+    }
+
+    variable->name = name;
+    variable->next = mod_phonenumber_match_variables;
+    mod_phonenumber_match_variables = variable;
+    switch_core_hash_insert(mod_phonenumber_match_variables_index, variable->name, variable);
+  } else {
+    switch_safe_free(name);
+  }
+
+  for (value = variable->values; value && strcmp(value->value, eq + 1); value = value->next)
+    ;
+
+  if (!value) {
+    if (!(value = (phonenumber_match_value_t *)calloc(1, sizeof(phonenumber_match_value_t)))) {
+      return false;
+    }
+
+    switch_strdup(value->value, eq + 1);
+    value->next = variable->values;
+    variable->values = value;
+  }
+
+  value->hooks |= bit;
+  variable->hooks |= bit;
+
+  return true;
+}
+
+/**
+ * Trie walk
+ *
+ * @param trie Trie to walk
+ * @param number Raw number
+ * @return Mask of the hooks the number applies to
+ */
+static uint64_t pn_match_walk(phonenumber_trie_t *trie, const char *number)
+{
+  uint64_t hooks = trie->any;
+  uint32_t node = 0;
+  int branch;
+
+  if (!trie->count || zstr(number)) {
+    return hooks;
+  }
+
+  for (; *number; number++) {
+    if (((branch = pn_match_branch(*number)) < 0) || !(node = trie->nodes[node].children[branch])) {
+      break;
+    }
+
+    hooks |= trie->nodes[node].hooks;
+  }
+
+  return hooks;
+}
+
+/**
+ * Hook selection
+ *
+ * @param channel Channel
+ * @param profile Channel's caller profile
+ * @return Mask of the hooks whose predicates hold for the channel
+ */
+uint64_t pn_match_hooks(switch_channel_t *channel, switch_caller_profile_t *profile)
+{
+  phonenumber_match_variable_t *variable;
+  phonenumber_match_value_t *value;
+  uint64_t hooks, matched;
+  const char *current;
+
+  hooks = pn_match_walk(&mod_phonenumber_match_caller, profile->orig_caller_id_number);
+  hooks &= pn_match_walk(&mod_phonenumber_match_destination, profile->destination_number);
+
+  for (variable = mod_phonenumber_match_variables; variable && hooks; variable = variable->next) {
+    if (!(hooks & variable->hooks)) {
+      continue;
+    }
+
+    matched = 0;
+
+    if ((current = switch_channel_get_variable(channel, variable->name))) {
+      for (value = variable->values; value; value = value->next) {
+        if (!strcmp(value->value, current)) {
+          matched |= value->hooks;
+        }
+      }
+    }
+
+    hooks &= ~(variable->hooks & ~matched);
+  }
+
+  return hooks;
+}
+
+/**
+ * Hook predicates teardown
+ */
+void pn_match_destroy()
+{
+  phonenumber_match_variable_t *variable, *next;
+  phonenumber_match_value_t *value, *next_value;
+
+  switch_safe_free(mod_phonenumber_match_caller.nodes);
+  switch_safe_free(mod_phonenumber_match_destination.nodes);
+  memset(&mod_phonenumber_match_caller, 0, sizeof(mod_phonenumber_match_caller));
+  memset(&mod_phonenumber_match_destination, 0, sizeof(mod_phonenumber_match_destination));
+
+  if (mod_phonenumber_match_variables_index) {
+    switch_core_hash_destroy(&mod_phonenumber_match_variables_index);
+  }
+
+  for (variable = mod_phonenumber_match_variables; variable; variable = next) {
+    next = variable->next;
+
+    for (value = variable->values; value; value = next_value) {
+      next_value = value->next;
+      switch_safe_free(value->value);
+      free(value);
+    }
+
+    switch_safe_free(variable->name);
+    free(variable);
+  }
+
+  mod_phonenumber_match_variables = NULL;
+}
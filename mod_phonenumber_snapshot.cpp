@@ -0,0 +1,310 @@
+/*
+ * Copyright (c) 2019 Ciprian Dosoftei
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+#include "mod_phonenumber.h"
+
+/**
+ * Snapshot configuration
+ *
+ * Snapshot file path (snapshots are disabled if not set), maximum number of
+ * results to persist and periodic save interval in seconds (0 means the
+ * snapshot is only written on shutdown), as defined in phonenumber.conf.xml.
+ */
+char *mod_phonenumber_snapshot_path = NULL;
+uint32_t mod_phonenumber_snapshot_size = PN_SNAPSHOT_DEFAULT_SIZE;
+uint32_t mod_phonenumber_snapshot_interval = 0;
+
+/**
+ * Serializes concurrent saves (timer vs. shutdown)
+ */
+static switch_mutex_t *mod_phonenumber_snapshot_mutex = NULL;
+
+/**
+ * Snapshot entry layout
+ *
+ * Every entry is stored as four length/identifier bytes (action, key length,
+ * suffix length, value length) followed by the unterminated strings.
+ */
+#define PN_SNAPSHOT_ENTRY_HEADER_LEN 4
+
+/**
+ * Snapshot writer
+ *
+ * Persists the hottest cached results (by hit count) to a temporary file,
+ * which then atomically replaces the snapshot.
+ *
+ * @return Whether or not the snapshot has been written
+ */
+switch_status_t pn_snapshot_save()
+{
+  vector<pair<uint32_t, uint32_t> > hot;
+  phonenumber_snapshot_header_t header;
+  phonenumber_capture_t capture;
+  phonenumber_action_id action;
+  char key[PN_CACHE_KEY_LEN], *tmp = NULL;
+  uint8_t entry[PN_SNAPSHOT_ENTRY_HEADER_LEN];
+  uint32_t hits, i, limit;
+  switch_status_t status = SWITCH_STATUS_FALSE;
+  FILE *fp = NULL;
+  int fd;
+
+  if (zstr(mod_phonenumber_snapshot_path) || !pn_cache_enabled()) {
+    return SWITCH_STATUS_SUCCESS;
+  }
+
+  switch_mutex_lock(mod_phonenumber_snapshot_mutex);
+
+  for (i = 0; i < mod_phonenumber_cache_size; i++) {
+    if (pn_cache_read_slot(i, &action, key, &capture, &hits)) {
+      hot.push_back(make_pair(hits, i));
+    }
+  }
+
+  limit = (hot.size() < mod_phonenumber_snapshot_size) ? hot.size() : mod_phonenumber_snapshot_size;
+  partial_sort(hot.begin(), hot.begin() + limit, hot.end(), greater<pair<uint32_t, uint32_t> >());
+
+  /* Unique per writer, instances sharing the snapshot must not interleave */
+  tmp = switch_mprintf("%s.XXXXXX", mod_phonenumber_snapshot_path);
+
+  if ((fd = mkstemp(tmp)) < 0) {
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Cannot write snapshot file %s\n", tmp);
+    goto done;
+  }
+
+  if (fchmod(fd, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH) || !(fp = fdopen(fd, "wb"))) {
+    close(fd);
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Cannot write snapshot file %s\n", tmp);
+    goto done;
+  }
+
+  memset(&header, 0, sizeof(header));
+  header.magic = PN_SNAPSHOT_MAGIC;
+  header.fingerprint = pn_cache_fingerprint();
+  switch_copy_string(header.version, PN_VERSION, sizeof(header.version));
+
+  if (fwrite(&header, sizeof(header), 1, fp) != 1) {
+    goto done;
+  }
+
+  /* Coldest first, so the hottest results win collisions when reloaded */
+  for (i = limit; i-- > 0;) {
+    /* The slot may have been recycled in the meantime */
+    if (!pn_cache_read_slot(hot[i].second, &action, key, &capture, &hits)) {
+      continue;
+    }
+
+    entry[0] = (uint8_t)action;
+    entry[1] = (uint8_t)strlen(key);
+    entry[2] = (uint8_t)strlen(capture.suffix);
+    entry[3] = (uint8_t)strlen(capture.value);
+
+    if ((fwrite(entry, sizeof(entry), 1, fp) != 1) || (fwrite(key, 1, entry[1], fp) != entry[1]) || (fwrite(capture.suffix, 1, entry[2], fp) != entry[2]) ||
+        (fwrite(capture.value, 1, entry[3], fp) != entry[3])) {
+      goto done;
+    }
+
+    header.count++;
+  }
+
+  if (fseek(fp, 0, SEEK_SET) || (fwrite(&header, sizeof(header), 1, fp) != 1)) {
+    goto done;
+  }
+
+  if (fclose(fp)) {
+    fp = NULL;
+    goto done;
+  }
+
+  fp = NULL;
+
+  if (rename(tmp, mod_phonenumber_snapshot_path)) {
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Cannot replace snapshot file %s\n", mod_phonenumber_snapshot_path);
+    goto done;
+  }
+
+  switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Saved %u results to snapshot %s\n", header.count, mod_phonenumber_snapshot_path);
+  status = SWITCH_STATUS_SUCCESS;
+
+done:
+  if (fp) {
+    fclose(fp);
+  }
+
+  if (status != SWITCH_STATUS_SUCCESS) {
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Cannot save snapshot %s\n", mod_phonenumber_snapshot_path);
+    unlink(tmp);
+  }
+
+  switch_safe_free(tmp);
+  switch_mutex_unlock(mod_phonenumber_snapshot_mutex);
+
+  return status;
+}
+
+/**
+ * Snapshot loader
+ *
+ * Maps the snapshot file and seeds the lookup cache with its results; the
+ * snapshot is discarded if it was produced by another module or metadata
+ * version.
+ *
+ * @return Whether or not the snapshot has been loaded
+ */
+switch_status_t pn_snapshot_load()
+{
+  phonenumber_snapshot_header_t *header;
+  phonenumber_capture_t capture;
+  char key[PN_CACHE_KEY_LEN];
+  const uint8_t *data, *end;
+  struct stat st;
+  uint32_t loaded = 0, i;
+  void *map;
+  int fd;
+
+  if (zstr(mod_phonenumber_snapshot_path) || !pn_cache_enabled()) {
+    return SWITCH_STATUS_SUCCESS;
+  }
+
+  if ((fd = open(mod_phonenumber_snapshot_path, O_RDONLY)) < 0) {
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "No snapshot to load from %s\n", mod_phonenumber_snapshot_path);
+    return SWITCH_STATUS_SUCCESS;
+  }
+
+  if (fstat(fd, &st) || ((size_t)st.st_size < sizeof(phonenumber_snapshot_header_t)) ||
+      ((map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)) {
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Cannot map snapshot file %s\n", mod_phonenumber_snapshot_path);
+    close(fd);
+    return SWITCH_STATUS_FALSE;
+  }
+
+  close(fd);
+
+  header = (phonenumber_snapshot_header_t *)map;
+
+  if ((header->magic != PN_SNAPSHOT_MAGIC) || (header->fingerprint != pn_cache_fingerprint()) || strncmp(header->version, PN_VERSION, sizeof(header->version))) {
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Discarding snapshot %s, written by another module or metadata version\n", mod_phonenumber_snapshot_path);
+    munmap(map, st.st_size);
+    return SWITCH_STATUS_SUCCESS;
+  }
+
+  data = (const uint8_t *)map + sizeof(phonenumber_snapshot_header_t);
+  end = (const uint8_t *)map + st.st_size;
+
+  for (i = 0; i < header->count; i++) {
+    if ((end - data < PN_SNAPSHOT_ENTRY_HEADER_LEN) || (end - data < PN_SNAPSHOT_ENTRY_HEADER_LEN + data[1] + data[2] + data[3]) ||
+        (data[0] >= phonenumber_action_id::ACTION_UNKNOWN) || (data[1] >= PN_CACHE_KEY_LEN) || (data[2] >= PN_CACHE_SUFFIX_LEN) || (data[3] >= PN_CACHE_VALUE_LEN)) {
+      switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Truncated or corrupt snapshot %s\n", mod_phonenumber_snapshot_path);
+      break;
+    }
+
+    memcpy(key, data + PN_SNAPSHOT_ENTRY_HEADER_LEN, data[1]);
+    key[data[1]] = '\0';
+    memcpy(capture.suffix, data + PN_SNAPSHOT_ENTRY_HEADER_LEN + data[1], data[2]);
+    capture.suffix[data[2]] = '\0';
+    memcpy(capture.value, data + PN_SNAPSHOT_ENTRY_HEADER_LEN + data[1] + data[2], data[3]);
+    capture.value[data[3]] = '\0';
+    capture.set = true;
+    capture.overflow = false;
+
+    pn_cache_put(key, (phonenumber_action_id)data[0], &capture);
+    loaded++;
+
+    data += PN_SNAPSHOT_ENTRY_HEADER_LEN + data[1] + data[2] + data[3];
+  }
+
+  munmap(map, st.st_size);
+
+  switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "Loaded %u results from snapshot %s\n", loaded, mod_phonenumber_snapshot_path);
+
+  return SWITCH_STATUS_SUCCESS;
+}
+
+/**
+ * Periodic snapshot task
+ */
+SWITCH_STANDARD_SCHED_FUNC(pn_snapshot_task)
+{
+  pn_snapshot_save();
+
+  task->runtime = switch_epoch_time_now(NULL) + mod_phonenumber_snapshot_interval;
+}
+
+/**
+ * Snapshot setup
+ *
+ * Warms up the lookup cache from the snapshot and schedules the periodic
+ * saves (if enabled).
+ *
+ * @param pool Module memory pool
+ * @return Whether or not we succeeded setting up snapshots
+ */
+switch_status_t pn_snapshot_init(switch_memory_pool_t *pool)
+{
+  if (zstr(mod_phonenumber_snapshot_path)) {
+    return SWITCH_STATUS_SUCCESS;
+  }
+
+  if (!pn_cache_enabled()) {
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Snapshots require the lookup cache (cache_size), ignoring snapshot_path\n");
+    switch_safe_free(mod_phonenumber_snapshot_path);
+    return SWITCH_STATUS_SUCCESS;
+  }
+
+  switch_mutex_init(&mod_phonenumber_snapshot_mutex, SWITCH_MUTEX_NESTED, pool);
+
+  pn_snapshot_load();
+
+  if (mod_phonenumber_snapshot_interval) {
+    switch_scheduler_add_task(switch_epoch_time_now(NULL) + mod_phonenumber_snapshot_interval, pn_snapshot_task, "mod_phonenumber_snapshot", PN_SNAPSHOT_GROUP, 0, NULL,
+                              SSHF_NONE);
+  }
+
+  return SWITCH_STATUS_SUCCESS;
+}
+
+/**
+ * Snapshot teardown
+ *
+ * Cancels the periodic saves and writes the final snapshot.
+ */
+void pn_snapshot_destroy()
+{
+  if (!zstr(mod_phonenumber_snapshot_path)) {
+    switch_scheduler_del_task_group(PN_SNAPSHOT_GROUP);
+    pn_snapshot_save();
+  }
+
+  switch_safe_free(mod_phonenumber_snapshot_path);
+  mod_phonenumber_snapshot_mutex = NULL;
+}
@@ -0,0 +1,395 @@
+/*
+ * Copyright (c) 2019 Ciprian Dosoftei
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+
+using namespace std;
+
+#include "mod_phonenumber.h"
+
+/**
+ * Heavy hitter tracker
+ *
+ * Per scope (caller/destination) count-min sketch, updated with relaxed
+ * atomics on every lookup, paired with a min-heap of the top-K numbers. The
+ * heap is only locked when a number's estimated count reaches the current
+ * heap floor, which is published atomically.
+ */
+struct phonenumber_top_entry {
+  char number[PN_TOP_NUMBER_LEN];
+  uint32_t count;
+};
+
+typedef struct phonenumber_top_entry phonenumber_top_entry_t;
+
+struct phonenumber_top {
+  atomic<uint32_t> sketch[PN_TOP_DEPTH][PN_TOP_WIDTH];
+  atomic<uint32_t> floor;
+  switch_mutex_t *mutex;
+  phonenumber_top_entry_t heap[PN_TOP_MAX_SIZE];
+  uint32_t used;
+};
+
+typedef struct phonenumber_top phonenumber_top_t;
+
+static phonenumber_top_t *mod_phonenumber_top[2] = { NULL, NULL };
+static atomic<int64_t> mod_phonenumber_top_next_decay(0);
+
+/**
+ * Heavy hitter tracking configuration
+ *
+ * Number of top entries per scope (0 disables the tracker) and decay
+ * interval in seconds (0 disables the decay), as defined in
+ * phonenumber.conf.xml.
+ */
+uint32_t mod_phonenumber_top_size = 0;
+uint32_t mod_phonenumber_top_decay = 0;
+
+/**
+ * Heap sift down
+ *
+ * @param top Tracker
+ * @param i Index of the entry to move down
+ */
+static void pn_top_sift_down(phonenumber_top_t *top, uint32_t i)
+{
+  phonenumber_top_entry_t tmp;
+  uint32_t smallest, l, r;
+
+  while (1) {
+    smallest = i;
+    l = (i << 1) + 1;
+    r = l + 1;
+
+    if ((l < top->used) && (top->heap[l].count < top->heap[smallest].count))
+      smallest = l;
+
+    if ((r < top->used) && (top->heap[r].count < top->heap[smallest].count))
+      smallest = r;
+
+    if (smallest == i)
+      break;
+
+    tmp = top->heap[i];
+    top->heap[i] = top->heap[smallest];
+    top->heap[smallest] = tmp;
+    i = smallest;
+  }
+}
+
+/**
+ * Heap sift up
+ *
+ * @param top Tracker
+ * @param i Index of the entry to move up
+ */
+static void pn_top_sift_up(phonenumber_top_t *top, uint32_t i)
+{
+  phonenumber_top_entry_t tmp;
+  uint32_t parent;
+
+  while (i) {
+    parent = (i - 1) >> 1;
+
+    if (top->heap[parent].count <= top->heap[i].count)
+      break;
+
+    tmp = top->heap[i];
+    top->heap[i] = top->heap[parent];
+    top->heap[parent] = tmp;
+    i = parent;
+  }
+}
+
+/**
+ * Tracker decay
+ *
+ * Halves every counter of a tracker, so old traffic fades out over time.
+ *
+ * @param top Tracker
+ */
+static void pn_top_decay(phonenumber_top_t *top)
+{
+  uint32_t i, j;
+
+  for (i = 0; i < PN_TOP_DEPTH; i++) {
+    for (j = 0; j < PN_TOP_WIDTH; j++) {
+      top->sketch[i][j].store(top->sketch[i][j].load(memory_order_relaxed) >> 1, memory_order_relaxed);
+    }
+  }
+
+  switch_mutex_lock(top->mutex);
+
+  for (i = 0; i < top->used; i++) {
+    top->heap[i].count >>= 1;
+  }
+
+  top->floor.store((top->used < mod_phonenumber_top_size) ? 0 : top->heap[0].count, memory_order_relaxed);
+
+  switch_mutex_unlock(top->mutex);
+}
+
+/**
+ * Tracker setup
+ *
+ * @param pool Module memory pool
+ * @return Whether or not we succeeded setting up the tracker
+ */
+switch_status_t pn_top_init(switch_memory_pool_t *pool)
+{
+  int i;
+
+  if (!mod_phonenumber_top_size) {
+    return SWITCH_STATUS_SUCCESS;
+  }
+
+  if (mod_phonenumber_top_size > PN_TOP_MAX_SIZE) {
+    mod_phonenumber_top_size = PN_TOP_MAX_SIZE;
+  }
+
+  for (i = 0; i < 2; i++) {
+    if (!(mod_phonenumber_top[i] = new (nothrow) phonenumber_top_t)) {
+      switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Cannot allocate heavy hitter tracker, possibly OOM!\n");
+      pn_top_destroy();
+      return SWITCH_STATUS_TERM;
+    }
+
+    mod_phonenumber_top[i]->used = 0;
+    switch_mutex_init(&mod_phonenumber_top[i]->mutex, SWITCH_MUTEX_NESTED, pool);
+  }
+
+  pn_top_reset();
+
+  if (mod_phonenumber_top_decay) {
+    mod_phonenumber_top_next_decay.store(switch_epoch_time_now(NULL) + mod_phonenumber_top_decay, memory_order_relaxed);
+  }
+
+  switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Configured heavy hitter tracking for top %u numbers\n", mod_phonenumber_top_size);
+
+  return SWITCH_STATUS_SUCCESS;
+}
+
+/**
+ * Tracker teardown
+ */
+void pn_top_destroy()
+{
+  int i;
+
+  for (i = 0; i < 2; i++) {
+    if (mod_phonenumber_top[i]) {
+      delete mod_phonenumber_top[i];
+      mod_phonenumber_top[i] = NULL;
+    }
+  }
+
+  mod_phonenumber_top_size = 0;
+  mod_phonenumber_top_decay = 0;
+}
+
+/**
+ * Tracker status
+ *
+ * @return Whether lookups are being counted
+ */
+bool pn_top_enabled()
+{
+  return mod_phonenumber_top[0] != NULL;
+}
+
+/**
+ * Tracker reset
+ *
+ * Clears all counters and top entries.
+ */
+void pn_top_reset()
+{
+  uint32_t i, j;
+  int k;
+
+  for (k = 0; k < 2; k++) {
+    phonenumber_top_t *top = mod_phonenumber_top[k];
+
+    if (!top)
+      continue;
+
+    for (i = 0; i < PN_TOP_DEPTH; i++) {
+      for (j = 0; j < PN_TOP_WIDTH; j++) {
+        top->sketch[i][j].store(0, memory_order_relaxed);
+      }
+    }
+
+    switch_mutex_lock(top->mutex);
+    top->used = 0;
+    top->floor.store(0, memory_order_relaxed);
+    switch_mutex_unlock(top->mutex);
+  }
+}
+
+/**
+ * Tracker update
+ *
+ * Counts a looked up number, under the scope given by the request prefix
+ * (only caller and destination numbers are tracked).
+ *
+ * @param prefix Request prefix
+ * @param number Looked up number
+ */
+void pn_top_update(const char *prefix, const char *number)
+{
+  phonenumber_top_t *top;
+  uint64_t hash;
+  uint32_t h1, h2, estimate = UINT32_MAX, count, i;
+  int64_t next, now;
+
+  if (zstr(prefix) || zstr(number)) {
+    return;
+  }
+
+  if (!strcmp(prefix, PN_CALLER)) {
+    top = mod_phonenumber_top[0];
+  } else if (!strcmp(prefix, PN_DESTINATION)) {
+    top = mod_phonenumber_top[1];
+  } else {
+    return;
+  }
+
+  if (mod_phonenumber_top_decay) {
+    next = mod_phonenumber_top_next_decay.load(memory_order_relaxed);
+    now = switch_epoch_time_now(NULL);
+
+    if ((now >= next) && mod_phonenumber_top_next_decay.compare_exchange_strong(next, now + mod_phonenumber_top_decay, memory_order_relaxed)) {
+      pn_top_decay(mod_phonenumber_top[0]);
+      pn_top_decay(mod_phonenumber_top[1]);
+    }
+  }
+
+  hash = pn_util_hash(number);
+  h1 = (uint32_t)hash;
+  h2 = (uint32_t)(hash >> 32) | 1;
+
+  for (i = 0; i < PN_TOP_DEPTH; i++) {
+    count = top->sketch[i][(h1 + (i * h2)) & (PN_TOP_WIDTH - 1)].fetch_add(1, memory_order_relaxed) + 1;
+
+    if (count < estimate)
+      estimate = count;
+  }
+
+  if (estimate < top->floor.load(memory_order_relaxed)) {
+    return;
+  }
+
+  switch_mutex_lock(top->mutex);
+
+  for (i = 0; i < top->used; i++) {
+    if (!strncmp(top->heap[i].number, number, PN_TOP_NUMBER_LEN - 1)) {
+      if (estimate > top->heap[i].count) {
+        top->heap[i].count = estimate;
+        pn_top_sift_down(top, i);
+      }
+      goto done;
+    }
+  }
+
+  if (top->used < mod_phonenumber_top_size) {
+    i = top->used++;
+  } else if (estimate > top->heap[0].count) {
+    i = 0;
+  } else {
+    goto done;
+  }
+
+  snprintf(top->heap[i].number, PN_TOP_NUMBER_LEN, "%s", number);
+  top->heap[i].count = estimate;
+
+  if (i) {
+    pn_top_sift_up(top, i);
+  } else {
+    pn_top_sift_down(top, i);
+  }
+
+done:
+  top->floor.store((top->used < mod_phonenumber_top_size) ? 0 : top->heap[0].count, memory_order_relaxed);
+  switch_mutex_unlock(top->mutex);
+}
+
+/**
+ * Tracker dump
+ *
+ * Writes the top entries of a scope to a stream, most frequent first.
+ *
+ * @param stream Output stream
+ * @param prefix Scope (caller or destination)
+ * @param k Maximum number of entries to write
+ */
+static void pn_top_dump_scope(switch_stream_handle_t *stream, const char *prefix, uint32_t k)
+{
+  phonenumber_top_t *top = mod_phonenumber_top[strcmp(prefix, PN_CALLER) ? 1 : 0];
+  phonenumber_top_entry_t entries[PN_TOP_MAX_SIZE], tmp;
+  uint32_t used, i, j;
+
+  switch_mutex_lock(top->mutex);
+  used = top->used;
+  memcpy(entries, top->heap, sizeof(phonenumber_top_entry_t) * used);
+  switch_mutex_unlock(top->mutex);
+
+  for (i = 1; i < used; i++) {
+    tmp = entries[i];
+
+    for (j = i; (j > 0) && (entries[j - 1].count < tmp.count); j--) {
+      entries[j] = entries[j - 1];
+    }
+
+    entries[j] = tmp;
+  }
+
+  for (i = 0; (i < used) && (i < k); i++) {
+    stream->write_function(stream, "%s %u %s\n", prefix, entries[i].count, entries[i].number);
+  }
+}
+
+/**
+ * Tracker dump
+ *
+ * @param stream Output stream
+ * @param scope Scope to dump (caller, destination or all)
+ * @param k Maximum number of entries to write per scope (0 for all)
+ */
+void pn_top_dump(switch_stream_handle_t *stream, phonenumber_scope scope, uint32_t k)
+{
+  if (!pn_top_enabled()) {
+    stream->write_function(stream, "-ERR: Heavy hitter tracking is disabled (top_size is 0)\n");
+    return;
+  }
+
+  if (!k || (k > mod_phonenumber_top_size)) {
+    k = mod_phonenumber_top_size;
+  }
+
+  if ((scope == phonenumber_scope::SCOPE_ALL) || (scope == phonenumber_scope::SCOPE_CALLER)) {
+    pn_top_dump_scope(stream, PN_CALLER, k);
+  }
+
+  if ((scope == phonenumber_scope::SCOPE_ALL) || (scope == phonenumber_scope::SCOPE_DESTINATION)) {
+    pn_top_dump_scope(stream, PN_DESTINATION, k);
+  }
+}
@@ -0,0 +1,309 @@
+/*
+ * Copyright (c) 2019 Ciprian Dosoftei
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <time.h>
+
+using namespace std;
+
+#include "mod_phonenumber.h"
+
+/**
+ * Trace ring buffer
+ *
+ * Fixed-size array of the most recent lookups. Writers claim slots through
+ * the mod_phonenumber_trace_head ticket counter and publish them with a
+ * per-slot sequence number (odd while the slot is being written), so neither
+ * writers nor readers ever take a lock.
+ */
+static phonenumber_trace_t *mod_phonenumber_trace = NULL;
+static uint32_t mod_phonenumber_trace_mask = 0;
+static atomic<uint64_t> mod_phonenumber_trace_head(0);
+
+/**
+ * Tracing configuration
+ *
+ * Ring buffer size (number of entries, 0 disables it) and slow lookup log
+ * threshold (in microseconds, 0 disables it) as defined in
+ * phonenumber.conf.xml.
+ */
+uint32_t mod_phonenumber_trace_size = 0;
+uint32_t mod_phonenumber_slow_threshold = 0;
+
+/**
+ * Tracing setup
+ *
+ * Allocates the ring buffer, rounding its size up to the next power of two.
+ *
+ * @return Whether or not we succeeded setting up tracing
+ */
+switch_status_t pn_trace_init()
+{
+  uint32_t size = 1;
+
+  if (!mod_phonenumber_trace_size) {
+    return SWITCH_STATUS_SUCCESS;
+  }
+
+  if (mod_phonenumber_trace_size > PN_TRACE_MAX_SIZE) {
+    mod_phonenumber_trace_size = PN_TRACE_MAX_SIZE;
+  }
+
+  while (size < mod_phonenumber_trace_size) {
+    size <<= 1;
+  }
+
+  if (!(mod_phonenumber_trace = new (nothrow) phonenumber_trace_t[size])) {
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Cannot allocate trace ring buffer, possibly OOM!\n");
+    mod_phonenumber_trace_size = 0;
+    return SWITCH_STATUS_TERM;
+  }
+
+  for (uint32_t i = 0; i < size; i++) {
+    mod_phonenumber_trace[i].seq.store(0, memory_order_relaxed);
+  }
+
+  mod_phonenumber_trace_size = size;
+  mod_phonenumber_trace_mask = size - 1;
+  mod_phonenumber_trace_head.store(0, memory_order_relaxed);
+
+  switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Configured trace ring buffer with %u entries\n", size);
+
+  return SWITCH_STATUS_SUCCESS;
+}
+
+/**
+ * Tracing teardown
+ */
+void pn_trace_destroy()
+{
+  if (mod_phonenumber_trace) {
+    delete[] mod_phonenumber_trace;
+    mod_phonenumber_trace = NULL;
+  }
+
+  mod_phonenumber_trace_size = 0;
+  mod_phonenumber_slow_threshold = 0;
+}
+
+/**
+ * Tracing status
+ *
+ * @return Whether lookups need to be timed at all
+ */
+bool pn_trace_enabled()
+{
+  return mod_phonenumber_trace || mod_phonenumber_slow_threshold;
+}
+
+/**
+ * Monotonic clock
+ *
+ * @return Current monotonic time in microseconds
+ */
+uint64_t pn_trace_now()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ((uint64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+/**
+ * Lookup start
+ *
+ * @param trace Trace record to initialize
+ * @param request Request being traced
+ */
+void pn_trace_begin(phonenumber_trace_t *trace, phonenumber_request_t *request)
+{
+  trace->timestamp = switch_micro_time_now();
+  snprintf(trace->input, sizeof(trace->input), "%s", request->number ? request->number : PN_EMPTY);
+  snprintf(trace->prefix, sizeof(trace->prefix), "%s", request->prefix ? request->prefix : PN_EMPTY);
+  trace->error = -1;
+  trace->parse_us = 0;
+  trace->total_us = 0;
+  trace->actc = 0;
+  trace->start = trace->mark = pn_trace_now();
+}
+
+/**
+ * Parsing stage completion
+ *
+ * @param trace Trace record
+ * @param error phone_util.Parse() return code
+ */
+void pn_trace_parse(phonenumber_trace_t *trace, int error)
+{
+  uint64_t now = pn_trace_now();
+
+  trace->error = error;
+  trace->parse_us = (uint32_t)(now - trace->mark);
+  trace->mark = now;
+}
+
+/**
+ * Action completion
+ *
+ * @param trace Trace record
+ * @param action Action which just completed
+ */
+void pn_trace_action(phonenumber_trace_t *trace, phonenumber_action_t action)
+{
+  uint64_t now = pn_trace_now();
+
+  if (trace->actc < PN_MAX_ACTIONS) {
+    trace->actions[trace->actc] = (uint8_t)pn_util_action_to_id(action);
+    trace->action_us[trace->actc++] = (uint32_t)(now - trace->mark);
+  }
+
+  trace->mark = now;
+}
+
+/**
+ * Trace formatter
+ *
+ * Renders a trace record as a single line.
+ *
+ * @param trace Trace record
+ * @param buf Output buffer
+ * @param len Output buffer length
+ */
+static void pn_trace_format(const phonenumber_trace_t *trace, char *buf, size_t len)
+{
+  size_t used;
+  int i;
+
+  used = snprintf(buf, len, "%" PRId64 " %s '%s' parse=%s/%uus", (int64_t)trace->timestamp, zstr(trace->prefix) ? "-" : trace->prefix, trace->input,
+                  pn_util_error_to_str(trace->error), trace->parse_us);
+
+  for (i = 0; (i < trace->actc) && (used < len); i++) {
+    used += snprintf(buf + used, len - used, " %s=%uus", pn_util_action_id_to_str((phonenumber_action_id)trace->actions[i]), trace->action_us[i]);
+  }
+
+  if (used < len) {
+    snprintf(buf + used, len - used, " total=%uus", trace->total_us);
+  }
+}
+
+/**
+ * Lookup completion
+ *
+ * Logs the lookup if it exceeded the slow lookup threshold and records it
+ * in the ring buffer.
+ *
+ * @param trace Trace record
+ */
+void pn_trace_end(phonenumber_trace_t *trace)
+{
+  phonenumber_trace_t *slot;
+  uint64_t ticket;
+
+  trace->total_us = (uint32_t)(pn_trace_now() - trace->start);
+
+  if (mod_phonenumber_slow_threshold && (trace->total_us >= mod_phonenumber_slow_threshold)) {
+    char line[1024];
+
+    pn_trace_format(trace, line, sizeof(line));
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Slow lookup: %s\n", line);
+  }
+
+  if (!mod_phonenumber_trace) {
+    return;
+  }
+
+  ticket = mod_phonenumber_trace_head.fetch_add(1, memory_order_relaxed);
+  slot = &mod_phonenumber_trace[ticket & mod_phonenumber_trace_mask];
+
+  slot->seq.store((ticket << 1) | 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+
+  slot->timestamp = trace->timestamp;
+  memcpy(slot->input, trace->input, sizeof(slot->input));
+  memcpy(slot->prefix, trace->prefix, sizeof(slot->prefix));
+  slot->error = trace->error;
+  slot->parse_us = trace->parse_us;
+  slot->total_us = trace->total_us;
+  slot->actc = trace->actc;
+  memcpy(slot->actions, trace->actions, sizeof(slot->actions));
+  memcpy(slot->action_us, trace->action_us, sizeof(slot->action_us));
+
+  slot->seq.store((ticket + 1) << 1, memory_order_release);
+}
+
+/**
+ * Ring buffer dump
+ *
+ * Writes the recorded lookups, oldest first, to a stream. Slots which are
+ * being written to while dumping are skipped.
+ *
+ * @param stream Output stream
+ */
+void pn_trace_dump(switch_stream_handle_t *stream)
+{
+  phonenumber_trace_t copy;
+  uint64_t head, ticket, seq;
+  char line[1024];
+
+  if (!mod_phonenumber_trace) {
+    stream->write_function(stream, "-ERR: Tracing is disabled (trace_size is 0)\n");
+    return;
+  }
+
+  head = mod_phonenumber_trace_head.load(memory_order_acquire);
+  ticket = (head > mod_phonenumber_trace_size) ? (head - mod_phonenumber_trace_size) : 0;
+
+  for (; ticket < head; ticket++) {
+    phonenumber_trace_t *slot = &mod_phonenumber_trace[ticket & mod_phonenumber_trace_mask];
+
+    seq = slot->seq.load(memory_order_acquire);
+    if (seq != ((ticket + 1) << 1)) {
+      continue;
+    }
+
+    copy.timestamp = slot->timestamp;
+    memcpy(copy.input, slot->input, sizeof(copy.input));
+    memcpy(copy.prefix, slot->prefix, sizeof(copy.prefix));
+    copy.error = slot->error;
+    copy.parse_us = slot->parse_us;
+    copy.total_us = slot->total_us;
+    copy.actc = slot->actc;
+    memcpy(copy.actions, slot->actions, sizeof(copy.actions));
+    memcpy(copy.action_us, slot->action_us, sizeof(copy.action_us));
+
+    atomic_thread_fence(memory_order_acquire);
+    if (slot->seq.load(memory_order_relaxed) != seq) {
+      continue;
+    }
+
+    copy.input[PN_TRACE_INPUT_LEN - 1] = '\0';
+    copy.prefix[PN_TRACE_PREFIX_LEN - 1] = '\0';
+    if (copy.actc > PN_MAX_ACTIONS) {
+      copy.actc = PN_MAX_ACTIONS;
+    }
+
+    pn_trace_format(&copy, line, sizeof(line));
+    stream->write_function(stream, "%s\n", line);
+  }
+}
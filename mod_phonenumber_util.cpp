@@ -20,6 +20,7 @@
  * SOFTWARE.
  */
 
+#include <inttypes.h>
 #include <stdio.h>
 
 using namespace std;
@@ -31,24 +32,66 @@ using i18n::phonenumbers::PhoneNumberUtil;
 
 #include "mod_phonenumber.h"
 
+static phonenumber_memo_t *pn_util_memo_get(phonenumber_request_t *request);
+static bool pn_util_set_region(phonenumber_config_t *config, const char *region);
+static bool pn_util_rule_key(switch_xml_t rule, char *key);
+
+#ifdef PN_USDT
+/**
+ * USDT probe semaphores, raised by the tracers attaching to the probes
+ */
+PN_PROBE_DEFINE(request__start);
+PN_PROBE_DEFINE(request__done);
+PN_PROBE_DEFINE(parse__start);
+PN_PROBE_DEFINE(parse__done);
+PN_PROBE_DEFINE(action__start);
+PN_PROBE_DEFINE(action__done);
+PN_PROBE_DEFINE(hook__match);
+PN_PROBE_DEFINE(hook__skip);
+#endif
+
+/**
+ * Translation lookup
+ *
+ * @param name Translation name
+ * @return Whether or not the translation is configured
+ */
+static bool pn_util_translation_exists(const char *name)
+{
+  return mod_phonenumber_translations_index && switch_core_hash_find(mod_phonenumber_translations_index, name);
+}
+
 /**
  * Configuration parser
  *
  * Parses phonenumber.conf.xml, creates the default configuration and sets up
- * hooks (to be used by the CS_INIT state handler).
+ * hooks (to be used by the CS_INIT state handler), routes, translation rules,
+ * profiles and membership lists.
  *
  * @return Whether or not we succeeded configuring the module.
  */
 switch_status_t pn_util_do_config()
 {
   const char *cf = "phonenumber.conf";
-  switch_xml_t cfg, xml, settings, param, hooks, hook_cfg;
+  switch_xml_t cfg, xml, settings, param, hooks, hook_cfg, routes, route_cfg, action_cfg, lists, list_cfg, profiles, profile_cfg, translations,
+      translation_cfg, rule_cfg;
   phonenumber_hook_t *hook = NULL;
+  phonenumber_list_t *list = NULL;
+  phonenumber_profile_t *profile = NULL;
+  phonenumber_route_t *route = NULL;
+  phonenumber_route_action_t *action = NULL;
+  phonenumber_translation_t *translation = NULL;
+  phonenumber_translation_rule_t *rule = NULL;
+  char *actions = NULL;
+  int hookc = 0;
 
   strcpy(mod_phonenumber_config.default_region, PN_DEFAULT_REGION);
+  mod_phonenumber_config.candidates[0] = '\0';
   mod_phonenumber_config.format = PN_DEFAULT_FORMAT;
   strcpy(mod_phonenumber_config.locale, PN_DEFAULT_LOCALE);
   strcpy(mod_phonenumber_config.calling_from, PN_DEFAULT_CALLING_FROM);
+  mod_phonenumber_config.list[0] = '\0';
+  mod_phonenumber_config.translation[0] = '\0';
 
   if (!(xml = switch_xml_open_cfg(cf, &cfg, NULL))) {
     switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Cannot open %s\n", cf);
@@ -61,11 +104,10 @@ switch_status_t pn_util_do_config()
       char *val = (char *)switch_xml_attr_soft(param, "value");
 
       if (!strncmp(var, PN_PARAM_DEFAULT_REGION, PN_PARAM_LEN_DEFAULT_REGION)) {
-        if (zstr(val) || (strlen(val) != 2)) {
+        if (!pn_util_set_region(&mod_phonenumber_config, val)) {
           switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Invalid default region: %s\n", val);
         } else {
-          strcpy(mod_phonenumber_config.default_region, val);
-          switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Configured default region: %s\n", mod_phonenumber_config.default_region);
+          switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Configured default region: %s\n", val);
         }
       } else if (!strncmp(var, PN_PARAM_FORMAT, PN_PARAM_LEN_FORMAT)) {
         mod_phonenumber_config.format = pn_util_str_to_format(val);
@@ -84,6 +126,51 @@ switch_status_t pn_util_do_config()
           strcpy(mod_phonenumber_config.calling_from, val);
           switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Configured calling from region: %s\n", mod_phonenumber_config.calling_from);
         }
+      } else if (!strncmp(var, PN_PARAM_TRACE_SIZE, PN_PARAM_LEN_TRACE_SIZE)) {
+        mod_phonenumber_trace_size = zstr(val) ? 0 : (uint32_t)atoi(val);
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Configured trace size: %u\n", mod_phonenumber_trace_size);
+      } else if (!strncmp(var, PN_PARAM_SLOW_THRESHOLD, PN_PARAM_LEN_SLOW_THRESHOLD)) {
+        mod_phonenumber_slow_threshold = zstr(val) ? 0 : (uint32_t)atoi(val);
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Configured slow lookup threshold: %uus\n", mod_phonenumber_slow_threshold);
+      } else if (!strncmp(var, PN_PARAM_TOP_SIZE, PN_PARAM_LEN_TOP_SIZE)) {
+        mod_phonenumber_top_size = zstr(val) ? 0 : (uint32_t)atoi(val);
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Configured heavy hitter tracking size: %u\n", mod_phonenumber_top_size);
+      } else if (!strncmp(var, PN_PARAM_CACHE_SIZE, PN_PARAM_LEN_CACHE_SIZE)) {
+        mod_phonenumber_cache_size = zstr(val) ? 0 : (uint32_t)atoi(val);
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Configured lookup cache size: %u\n", mod_phonenumber_cache_size);
+      } else if (!strncmp(var, PN_PARAM_CACHE_PATH, PN_PARAM_LEN_CACHE_PATH)) {
+        switch_safe_free(mod_phonenumber_cache_path);
+        if (!zstr(val)) {
+          switch_strdup(mod_phonenumber_cache_path, val);
+        }
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Configured lookup cache path: %s\n", val);
+      } else if (!strncmp(var, PN_PARAM_SNAPSHOT_PATH, PN_PARAM_LEN_SNAPSHOT_PATH)) {
+        switch_safe_free(mod_phonenumber_snapshot_path);
+        if (!zstr(val)) {
+          switch_strdup(mod_phonenumber_snapshot_path, val);
+        }
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Configured snapshot path: %s\n", val);
+      } else if (!strncmp(var, PN_PARAM_SNAPSHOT_SIZE, PN_PARAM_LEN_SNAPSHOT_SIZE)) {
+        mod_phonenumber_snapshot_size = zstr(val) ? 0 : (uint32_t)atoi(val);
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Configured snapshot size: %u\n", mod_phonenumber_snapshot_size);
+      } else if (!strncmp(var, PN_PARAM_SNAPSHOT_INTERVAL, PN_PARAM_LEN_SNAPSHOT_INTERVAL)) {
+        mod_phonenumber_snapshot_interval = zstr(val) ? 0 : (uint32_t)atoi(val);
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Configured snapshot interval: %us\n", mod_phonenumber_snapshot_interval);
+      } else if (!strncmp(var, PN_PARAM_ASYNC_WORKERS, PN_PARAM_LEN_ASYNC_WORKERS)) {
+        mod_phonenumber_async_workers = zstr(val) ? 0 : (uint32_t)atoi(val);
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Configured asynchronous lookup workers: %u\n", mod_phonenumber_async_workers);
+      } else if (!strncmp(var, PN_PARAM_ASYNC_QUEUE_SIZE, PN_PARAM_LEN_ASYNC_QUEUE_SIZE)) {
+        mod_phonenumber_async_queue_size = zstr(val) ? 0 : (uint32_t)atoi(val);
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Configured asynchronous lookup queue size: %u\n", mod_phonenumber_async_queue_size);
+      } else if (!strncmp(var, PN_PARAM_PROFILE_VARIABLE, PN_PARAM_LEN_PROFILE_VARIABLE)) {
+        switch_safe_free(mod_phonenumber_profile_variable);
+        if (!zstr(val)) {
+          switch_strdup(mod_phonenumber_profile_variable, val);
+        }
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Configured profile variable: %s\n", val);
+      } else if (!strncmp(var, PN_PARAM_TOP_DECAY, PN_PARAM_LEN_TOP_DECAY)) {
+        mod_phonenumber_top_decay = zstr(val) ? 0 : (uint32_t)atoi(val);
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Configured heavy hitter decay interval: %us\n", mod_phonenumber_top_decay);
       } else {
         switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Unknown configuration parameter %s\n", var);
       }
@@ -92,6 +179,10 @@ switch_status_t pn_util_do_config()
 
   if ((hooks = switch_xml_child(cfg, "hooks"))) {
     for (hook_cfg = switch_xml_child(hooks, "hook"); hook_cfg; hook_cfg = hook_cfg->next) {
+      if (hookc == PN_MAX_HOOKS) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "More than %d hooks, the remaining ones are evaluated for every channel\n", PN_MAX_HOOKS);
+      }
+
       if (!mod_phonenumber_hooks) {
         mod_phonenumber_hooks = (phonenumber_hook_t *)malloc(sizeof(phonenumber_hook_t));
         hook = mod_phonenumber_hooks;
@@ -108,9 +199,18 @@ switch_status_t pn_util_do_config()
       hook->context = NULL;
       hook->direction = phonenumber_direction::DIRECTION_ALL;
       hook->scope = phonenumber_scope::SCOPE_ALL;
+      hook->phase = phonenumber_phase::PHASE_INIT;
       hook->config = mod_phonenumber_config;
       hook->actions = NULL;
+      hook->propagate = false;
+      hook->profiled = true;
+      hook->disabled = false;
+      hook->index = hookc;
+      hook->bit = (hookc < PN_MAX_HOOKS) ? (1ULL << hookc) : 0;
+      hookc++;
+      hook->signature[0] = '\0';
       hook->next = NULL;
+      pn_match_hook(hook->bit);
 
       for (param = switch_xml_child(hook_cfg, "param"); param; param = param->next) {
         char *var = (char *)switch_xml_attr_soft(param, "name");
@@ -125,23 +225,39 @@ switch_status_t pn_util_do_config()
         } else if (!strncmp(var, PN_PARAM_SCOPE, PN_PARAM_LEN_SCOPE)) {
           hook->scope = pn_util_str_to_scope(val);
           switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Configured hook scope: %s\n", pn_util_scope_to_str(hook->scope));
+        } else if (!strncmp(var, PN_PARAM_PHASE, PN_PARAM_LEN_PHASE)) {
+          hook->phase = pn_util_str_to_phase(val);
+          switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Configured hook phase: %s\n", pn_util_phase_to_str(hook->phase));
         } else if (!strncmp(var, PN_PARAM_ACTIONS, PN_PARAM_LEN_ACTIONS)) {
+          /* Parsing splits the string in place, keep it whole for the signature */
+          switch_safe_free(actions);
+          switch_strdup(actions, val);
           hook->actions = pn_util_parse_actions(val);
+
+          if (pn_util_actions_empty(hook->actions)) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Invalid hook actions: %s, disabling hook\n", actions);
+            hook->disabled = true;
+          }
+        } else if (!strncmp(var, PN_PARAM_PROPAGATE, PN_PARAM_LEN_PROPAGATE)) {
+          hook->propagate = switch_true(val);
+          switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Configured hook propagation: %s\n", hook->propagate ? "true" : "false");
         } else if (!strncmp(var, PN_PARAM_DEFAULT_REGION, PN_PARAM_LEN_DEFAULT_REGION)) {
-          if (zstr(val) || (strlen(val) != 2)) {
+          if (!pn_util_set_region(&hook->config, val)) {
             switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Invalid hook default region: %s\n", val);
           } else {
-            strcpy(hook->config.default_region, val);
-            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Configured hook default region: %s\n", hook->config.default_region);
+            hook->profiled = false;
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Configured hook default region: %s\n", val);
           }
         } else if (!strncmp(var, PN_PARAM_FORMAT, PN_PARAM_LEN_FORMAT)) {
           hook->config.format = pn_util_str_to_format(val);
+          hook->profiled = false;
           switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Configured hook format: %s\n", pn_util_format_to_str(hook->config.format));
         } else if (!strncmp(var, PN_PARAM_LOCALE, PN_PARAM_LEN_LOCALE)) {
           if (zstr(val) || (strlen(val) != 5)) {
             switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Invalid hook locale: %s\n", val);
           } else {
             strcpy(hook->config.locale, val);
+            hook->profiled = false;
             switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Configured hook locale: %s\n", hook->config.locale);
           }
         } else if (!strncmp(var, PN_PARAM_CALLING_FROM, PN_PARAM_LEN_CALLING_FROM)) {
@@ -149,12 +265,307 @@ switch_status_t pn_util_do_config()
             switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Invalid hook calling from region: %s\n", val);
           } else {
             strcpy(hook->config.calling_from, val);
+            hook->profiled = false;
             switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Configured hook calling from region: %s\n", hook->config.calling_from);
           }
+        } else if (!hook->bit && (!strncmp(var, PN_PARAM_CALLER_PREFIX, PN_PARAM_LEN_CALLER_PREFIX) ||
+                                  !strncmp(var, PN_PARAM_DESTINATION_PREFIX, PN_PARAM_LEN_DESTINATION_PREFIX) ||
+                                  !strncmp(var, PN_PARAM_MATCH_VARIABLE, PN_PARAM_LEN_MATCH_VARIABLE))) {
+          switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Hook %u has a %s filter, only the first %d hooks can be filtered; disabling hook\n",
+                            hook->index + 1, var, PN_MAX_HOOKS);
+          hook->disabled = true;
+        } else if (!strncmp(var, PN_PARAM_CALLER_PREFIX, PN_PARAM_LEN_CALLER_PREFIX)) {
+          if (!pn_match_add_prefixes(phonenumber_scope::SCOPE_CALLER, val, hook->bit)) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Invalid hook caller prefix: %s, disabling hook\n", val);
+            hook->disabled = true;
+          } else {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Configured hook caller prefix: %s\n", val);
+          }
+        } else if (!strncmp(var, PN_PARAM_DESTINATION_PREFIX, PN_PARAM_LEN_DESTINATION_PREFIX)) {
+          if (!pn_match_add_prefixes(phonenumber_scope::SCOPE_DESTINATION, val, hook->bit)) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Invalid hook destination prefix: %s, disabling hook\n", val);
+            hook->disabled = true;
+          } else {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Configured hook destination prefix: %s\n", val);
+          }
+        } else if (!strncmp(var, PN_PARAM_MATCH_VARIABLE, PN_PARAM_LEN_MATCH_VARIABLE)) {
+          if (!pn_match_add_variable(val, hook->bit)) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Invalid hook variable condition: %s, disabling hook\n", val);
+            hook->disabled = true;
+          } else {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Configured hook variable condition: %s\n", val);
+          }
+        } else if (!strncmp(var, PN_PARAM_LIST, PN_PARAM_LEN_LIST)) {
+          switch_copy_string(hook->config.list, val, sizeof(hook->config.list));
+          hook->profiled = false;
+          switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Configured hook list: %s\n", hook->config.list);
+        } else if (!strncmp(var, PN_PARAM_TRANSLATION, PN_PARAM_LEN_TRANSLATION)) {
+          switch_copy_string(hook->config.translation, val, sizeof(hook->config.translation));
+          hook->profiled = false;
+          switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Configured hook translation: %s\n", hook->config.translation);
         } else {
           switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Unknown hook configuration parameter %s\n", var);
         }
       }
+
+      if (hook->propagate) {
+        pn_util_signature(actions ? actions : "", &hook->config, hook->signature);
+      }
+
+      if (!hook->disabled) {
+        mod_phonenumber_phase_hooks[hook->phase]++;
+      }
+
+      switch_safe_free(actions);
+    }
+  }
+
+  if ((routes = switch_xml_child(cfg, "routes"))) {
+    switch_core_hash_init(&mod_phonenumber_routes_index);
+
+    for (route_cfg = switch_xml_child(routes, "route"); route_cfg; route_cfg = route_cfg->next) {
+      char key[PN_ROUTE_KEY_LEN];
+
+      if (!pn_util_rule_key(route_cfg, key)) {
+        continue;
+      }
+
+      if (switch_core_hash_find(mod_phonenumber_routes_index, key)) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Duplicate route %s, ignoring\n", key);
+        continue;
+      }
+
+      if (!mod_phonenumber_routes) {
+        mod_phonenumber_routes = (phonenumber_route_t *)malloc(sizeof(phonenumber_route_t));
+        route = mod_phonenumber_routes;
+      } else {
+        route->next = (phonenumber_route_t *)malloc(sizeof(phonenumber_route_t));
+        route = route->next;
+      }
+
+      if (!route) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Cannot create phonenumber route, possibly OOM!\n");
+        return SWITCH_STATUS_TERM;
+      }
+
+      switch_strdup(route->key, key);
+      route->actions = NULL;
+      route->next = NULL;
+
+      for (action_cfg = switch_xml_child(route_cfg, "action"); action_cfg; action_cfg = action_cfg->next) {
+        const char *application = switch_xml_attr_soft(action_cfg, "application");
+
+        if (zstr(application)) {
+          switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Route %s has an action without application\n", key);
+          continue;
+        }
+
+        if (!route->actions) {
+          route->actions = (phonenumber_route_action_t *)malloc(sizeof(phonenumber_route_action_t));
+          action = route->actions;
+        } else {
+          action->next = (phonenumber_route_action_t *)malloc(sizeof(phonenumber_route_action_t));
+          action = action->next;
+        }
+
+        if (!action) {
+          switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Cannot create phonenumber route action, possibly OOM!\n");
+          return SWITCH_STATUS_TERM;
+        }
+
+        switch_strdup(action->application, application);
+        switch_strdup(action->data, switch_xml_attr_soft(action_cfg, "data"));
+        action->next = NULL;
+      }
+
+      switch_core_hash_insert(mod_phonenumber_routes_index, route->key, route);
+      switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Configured route: %s\n", route->key);
+    }
+  }
+
+  if ((translations = switch_xml_child(cfg, "translations"))) {
+    switch_core_hash_init(&mod_phonenumber_translations_index);
+
+    for (translation_cfg = switch_xml_child(translations, "translation"); translation_cfg; translation_cfg = translation_cfg->next) {
+      const char *name = switch_xml_attr(translation_cfg, "name");
+
+      if (zstr(name) || (strlen(name) >= PN_TRANSLATION_NAME_LEN)) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Invalid translation name: %s\n", name);
+        continue;
+      }
+
+      if (switch_core_hash_find(mod_phonenumber_translations_index, name)) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Duplicate translation %s, ignoring\n", name);
+        continue;
+      }
+
+      if (!(translation = (phonenumber_translation_t *)calloc(1, sizeof(phonenumber_translation_t)))) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Cannot create phonenumber translation, possibly OOM!\n");
+        return SWITCH_STATUS_TERM;
+      }
+
+      switch_strdup(translation->name, name);
+      switch_core_hash_init(&translation->index);
+      translation->next = mod_phonenumber_translations;
+      mod_phonenumber_translations = translation;
+
+      for (rule_cfg = switch_xml_child(translation_cfg, "rule"); rule_cfg; rule_cfg = rule_cfg->next) {
+        char *format = (char *)switch_xml_attr_soft(rule_cfg, "format");
+        const char *calling_from = switch_xml_attr_soft(rule_cfg, "calling_from");
+        const char *prefix = switch_xml_attr_soft(rule_cfg, "prefix");
+        char key[PN_ROUTE_KEY_LEN];
+
+        if (!pn_util_rule_key(rule_cfg, key)) {
+          continue;
+        }
+
+        if (switch_core_hash_find(translation->index, key)) {
+          switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Duplicate translation %s rule %s, ignoring\n", name, key);
+          continue;
+        }
+
+        if (!zstr(calling_from) && (strlen(calling_from) != 2)) {
+          switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Invalid translation %s rule %s calling from region: %s\n", name, key, calling_from);
+          continue;
+        }
+
+        if (strlen(prefix) >= PN_TRANSLATE_PREFIX_LEN) {
+          switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Invalid translation %s rule %s prefix: %s\n", name, key, prefix);
+          continue;
+        }
+
+        if (!(rule = (phonenumber_translation_rule_t *)calloc(1, sizeof(phonenumber_translation_rule_t)))) {
+          switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Cannot create phonenumber translation rule, possibly OOM!\n");
+          return SWITCH_STATUS_TERM;
+        }
+
+        strcpy(rule->key, key);
+        strcpy(rule->calling_from, calling_from);
+        strcpy(rule->prefix, prefix);
+        rule->digits_only = switch_true(switch_xml_attr_soft(rule_cfg, "digits_only"));
+        rule->format = pn_util_str_to_format(format);
+
+        if (!strcasecmp(format, PN_TRANSLATE_OUT_OF_COUNTRY)) {
+          rule->mode = phonenumber_translate_mode::TRANSLATE_OUT_OF_COUNTRY;
+        } else if (!strcasecmp(format, PN_TRANSLATE_NSN)) {
+          rule->mode = phonenumber_translate_mode::TRANSLATE_NSN;
+        } else {
+          rule->mode = phonenumber_translate_mode::TRANSLATE_FORMAT;
+        }
+
+        rule->next = translation->rules;
+        translation->rules = rule;
+
+        switch_core_hash_insert(translation->index, rule->key, rule);
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Configured translation %s rule: %s\n", name, rule->key);
+      }
+
+      switch_core_hash_insert(mod_phonenumber_translations_index, translation->name, translation);
+    }
+  }
+
+  if ((profiles = switch_xml_child(cfg, "profiles"))) {
+    switch_core_hash_init(&mod_phonenumber_profiles_index);
+
+    for (profile_cfg = switch_xml_child(profiles, "profile"); profile_cfg; profile_cfg = profile_cfg->next) {
+      const char *name = switch_xml_attr(profile_cfg, "name");
+
+      if (zstr(name)) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Profile without name, ignoring\n");
+        continue;
+      }
+
+      if (switch_core_hash_find(mod_phonenumber_profiles_index, name)) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Duplicate profile %s, ignoring\n", name);
+        continue;
+      }
+
+      if (!(profile = (phonenumber_profile_t *)malloc(sizeof(phonenumber_profile_t)))) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Cannot create phonenumber profile, possibly OOM!\n");
+        return SWITCH_STATUS_TERM;
+      }
+
+      switch_strdup(profile->name, name);
+      profile->config = mod_phonenumber_config;
+      profile->next = mod_phonenumber_profiles;
+      mod_phonenumber_profiles = profile;
+
+      for (param = switch_xml_child(profile_cfg, "param"); param; param = param->next) {
+        char *var = (char *)switch_xml_attr_soft(param, "name");
+        char *val = (char *)switch_xml_attr_soft(param, "value");
+
+        if (!strncmp(var, PN_PARAM_DEFAULT_REGION, PN_PARAM_LEN_DEFAULT_REGION)) {
+          if (!pn_util_set_region(&profile->config, val)) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Invalid profile %s default region: %s\n", name, val);
+          }
+        } else if (!strncmp(var, PN_PARAM_FORMAT, PN_PARAM_LEN_FORMAT)) {
+          profile->config.format = pn_util_str_to_format(val);
+        } else if (!strncmp(var, PN_PARAM_LOCALE, PN_PARAM_LEN_LOCALE)) {
+          if (zstr(val) || (strlen(val) != 5)) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Invalid profile %s locale: %s\n", name, val);
+          } else {
+            strcpy(profile->config.locale, val);
+          }
+        } else if (!strncmp(var, PN_PARAM_CALLING_FROM, PN_PARAM_LEN_CALLING_FROM)) {
+          if (zstr(val) || (strlen(val) != 2)) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Invalid profile %s calling from region: %s\n", name, val);
+          } else {
+            strcpy(profile->config.calling_from, val);
+          }
+        } else if (!strncmp(var, PN_PARAM_LIST, PN_PARAM_LEN_LIST)) {
+          switch_copy_string(profile->config.list, val, sizeof(profile->config.list));
+        } else if (!strncmp(var, PN_PARAM_TRANSLATION, PN_PARAM_LEN_TRANSLATION)) {
+          switch_copy_string(profile->config.translation, val, sizeof(profile->config.translation));
+        } else {
+          switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Unknown profile configuration parameter %s\n", var);
+        }
+      }
+
+      switch_core_hash_insert(mod_phonenumber_profiles_index, profile->name, &profile->config);
+      switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Configured profile %s: %s/%s/%s/%s\n", profile->name, profile->config.default_region,
+                        pn_util_format_to_str(profile->config.format), profile->config.locale, profile->config.calling_from);
+    }
+  }
+
+  if ((lists = switch_xml_child(cfg, "lists"))) {
+    for (list_cfg = switch_xml_child(lists, "list"); list_cfg; list_cfg = list_cfg->next) {
+      const char *name = switch_xml_attr(list_cfg, "name");
+      const char *path = switch_xml_attr(list_cfg, "path");
+
+      if (zstr(name) || (strlen(name) >= PN_LIST_NAME_LEN) || zstr(path)) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Invalid list definition (name: %s, path: %s)\n", name, path);
+        continue;
+      }
+
+      if (!mod_phonenumber_lists) {
+        mod_phonenumber_lists = (phonenumber_list_t *)calloc(1, sizeof(phonenumber_list_t));
+        list = mod_phonenumber_lists;
+      } else {
+        list->next = (phonenumber_list_t *)calloc(1, sizeof(phonenumber_list_t));
+        list = list->next;
+      }
+
+      if (!list) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Cannot create phonenumber list, possibly OOM!\n");
+        return SWITCH_STATUS_TERM;
+      }
+
+      switch_copy_string(list->name, name, sizeof(list->name));
+      switch_strdup(list->path, path);
+      switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Configured list %s: %s\n", list->name, list->path);
+    }
+  }
+
+  /* Checked once here, the translate action itself only logs at debug level */
+  for (hook = mod_phonenumber_hooks; hook; hook = hook->next) {
+    if (!zstr(hook->config.translation) && !pn_util_translation_exists(hook->config.translation)) {
+      switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Unknown translation for hook #%u: %s\n", hook->index, hook->config.translation);
+    }
+  }
+
+  for (profile = mod_phonenumber_profiles; profile; profile = profile->next) {
+    if (!zstr(profile->config.translation) && !pn_util_translation_exists(profile->config.translation)) {
+      switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "Unknown translation for profile %s: %s\n", profile->name, profile->config.translation);
     }
   }
 
@@ -166,17 +577,19 @@ switch_status_t pn_util_do_config()
  *
  * Parses out any configuration parameters which may have been passed when
  * the module is invoked via the dialplan application or through the API. It
- * eventually falls back to any configured default values for any undefined
- * parameters.
+ * eventually falls back to the selected profile (profile=<name> argument,
+ * otherwise the channel's profile_variable) or to the configured default
+ * values for any undefined parameters.
  *
  * @param str String to be parsed
+ * @param channel Channel the configuration applies to (may be NULL)
  * @return Parsed configuration
  */
-phonenumber_config_t *pn_util_parse_config(char *str)
+phonenumber_config_t *pn_util_parse_config(char *str, switch_channel_t *channel)
 {
   int i, argc = 0;
   char *argv[10] = { 0 }, *tuple[2] = { 0 };
-  phonenumber_config_t *config;
+  phonenumber_config_t *config, *profile;
 
   config = (phonenumber_config_t *)malloc(sizeof(*config));
   if (!config) {
@@ -184,17 +597,32 @@ phonenumber_config_t *pn_util_parse_config(char *str)
     return NULL;
   }
 
-  *config = mod_phonenumber_config;
+  *config = (profile = pn_util_channel_profile(channel)) ? *profile : mod_phonenumber_config;
 
   if (!zstr(str)) {
-    argc = switch_separate_string(str, ',', argv, 4);
+    argc = switch_separate_string(str, ',', argv, (sizeof(argv) / sizeof(argv[0])));
+
+    /* The profile is the base the other arguments apply to */
     for (i = 0; i < argc; i++) {
+      if (!strncmp(argv[i], PN_PARAM_PROFILE, PN_PARAM_LEN_PROFILE)) {
+        if (!mod_phonenumber_profiles_index ||
+            !(profile = (phonenumber_config_t *)switch_core_hash_find(mod_phonenumber_profiles_index, argv[i] + PN_PARAM_LEN_PROFILE))) {
+          switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Unknown profile: %s\n", argv[i] + PN_PARAM_LEN_PROFILE);
+        } else {
+          *config = *profile;
+        }
+      }
+    }
+
+    for (i = 0; i < argc; i++) {
+      if (!strncmp(argv[i], PN_PARAM_PROFILE, PN_PARAM_LEN_PROFILE)) {
+        continue;
+      }
+
       if (switch_separate_string(argv[i], '=', tuple, 2) == 2) {
         if (!strncasecmp(tuple[0], PN_PARAM_DEFAULT_REGION, PN_PARAM_LEN_DEFAULT_REGION)) {
-          if (zstr(tuple[1]) || (strlen(tuple[1]) != 2)) {
+          if (!pn_util_set_region(config, tuple[1])) {
             switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Invalid default region: %s\n", tuple[1]);
-          } else {
-            strcpy(config->default_region, tuple[1]);
           }
         } else if (!strncasecmp(tuple[0], PN_PARAM_FORMAT, PN_PARAM_LEN_FORMAT)) {
           config->format = pn_util_str_to_format(tuple[1]);
@@ -210,6 +638,10 @@ phonenumber_config_t *pn_util_parse_config(char *str)
           } else {
             strcpy(config->calling_from, tuple[1]);
           }
+        } else if (!strncmp(tuple[0], PN_PARAM_LIST, PN_PARAM_LEN_LIST)) {
+          switch_copy_string(config->list, tuple[1], sizeof(config->list));
+        } else if (!strncmp(tuple[0], PN_PARAM_TRANSLATION, PN_PARAM_LEN_TRANSLATION)) {
+          switch_copy_string(config->translation, tuple[1], sizeof(config->translation));
         } else {
           switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Unknown configuration argument %s\n", tuple[0]);
         }
@@ -223,150 +655,1276 @@ phonenumber_config_t *pn_util_parse_config(char *str)
 }
 
 /**
- * Action parser
+ * Rule key parser
  *
- * Parses out actions passed when the module is invoked via the dialplan\
- * application or through the API.
+ * Validates the region, type and valid attributes shared by the routing and
+ * translation rules and composes the rule's index key out of them.
  *
- * @param str String to be parsed
- * @return Array of parsed actions
+ * @param rule Rule element
+ * @param key Output buffer, at least PN_ROUTE_KEY_LEN bytes long
+ * @return Whether or not the attributes are valid
  */
-phonenumber_action_t *pn_util_parse_actions(char *str)
+static bool pn_util_rule_key(switch_xml_t rule, char *key)
 {
-  int actc, i, j = 0;
-  char *actv[PN_MAX_ACTIONS] = { NULL };
-  phonenumber_action_t *actions = (phonenumber_action_t *)malloc(sizeof(phonenumber_action_t) * PN_MAX_ACTIONS);
+  const char *region = switch_xml_attr(rule, "region");
+  const char *type = switch_xml_attr(rule, "type");
+  const char *valid = switch_xml_attr(rule, "valid");
+  char region_code[3];
 
-  if (!actions) {
-    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_CRIT, "Unable to parse the actions, possibly OOM!\n");
-    return NULL;
+  if (zstr(region) || !strcmp(region, PN_ROUTE_ANY)) {
+    region = PN_ROUTE_ANY;
+  } else if (strlen(region) != 2) {
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Invalid %s region: %s\n", rule->name, region);
+    return false;
+  } else {
+    region_code[0] = toupper(region[0]);
+    region_code[1] = toupper(region[1]);
+    region_code[2] = '\0';
+    region = region_code;
   }
 
-  if (!(actc = switch_separate_string(str, ',', actv, PN_MAX_ACTIONS))) {
-    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Cannot parse out any actions: %s\n", str);
+  if (zstr(type) || !strcmp(type, PN_ROUTE_ANY)) {
+    type = PN_ROUTE_ANY;
+  } else if (strcasecmp(type, pn_util_type_to_str(pn_util_str_to_type(type)))) {
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Invalid %s type: %s\n", rule->name, type);
+    return false;
   } else {
-    for (i = 0; i < actc; i++) {
-      actions[j] = pn_util_match_action_function(actv[i]);
-      if (!actions[j]) {
-        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Unknown action: %s\n", actv[i]);
-      } else {
-        j++;
-      }
-    }
+    type = pn_util_type_to_str(pn_util_str_to_type(type));
   }
 
-  if (j < PN_MAX_ACTIONS) {
-    actions[j] = NULL;
+  if (zstr(valid) || !strcmp(valid, PN_ROUTE_ANY)) {
+    valid = PN_ROUTE_ANY;
+  } else {
+    valid = switch_true(valid) ? "true" : "false";
   }
 
-  return actions;
+  pn_util_route_key(key, region, type, valid);
+
+  return true;
 }
 
 /**
- * Action executor
+ * Default region setter
  *
- * Executes an array of actions over a request.
+ * Accepts either a single region code or up to PN_MAX_REGION_CANDIDATES
+ * candidate regions separated by PN_REGION_SEPARATOR (e.g. US|CA|JM), each
+ * known to libphonenumber; the first one becomes the default region, the
+ * whole list is kept for pn_util_parse_candidates. A single code is taken as
+ * is (ZZ only parses numbers carrying their calling code).
  *
- * @param actions Array of parsed actions
- * @param request Request to action on
+ * @param config Configuration to update
+ * @param region Region code(s)
+ * @return Whether or not the value is valid
  */
-void pn_util_exec(phonenumber_action_t *actions, phonenumber_request_t *request)
+static bool pn_util_set_region(phonenumber_config_t *config, const char *region)
 {
-  int actc = 0;
+  size_t length = zstr(region) ? 0 : strlen(region), i;
 
-  if (request->channel && request->prefix) {
-    switch_channel_set_variable_name_printf(request->channel, request->number, "phonenumber_%s_input", request->prefix);
+  if ((length < 2) || ((length + 1) % 3) || (length >= sizeof(config->candidates))) {
+    return false;
   }
 
-  if (actions) {
-    request->parsed = new PhoneNumber;
-    phone_util.Parse(request->number, request->config->default_region, request->parsed);
-
-    while (actions[actc] && (actc < PN_MAX_ACTIONS)) {
-      actions[actc++](request);
+  for (i = 0; (length > 2) && (i < length); i += 3) {
+    if (((i + 2 < length) && (region[i + 2] != PN_REGION_SEPARATOR)) || !phone_util.GetCountryCodeForRegion(string(region + i, 2))) {
+      return false;
     }
+  }
 
-    delete request->parsed;
+  memcpy(config->default_region, region, 2);
+  config->default_region[2] = '\0';
+
+  if (length > 2) {
+    strcpy(config->candidates, region);
+  } else {
+    config->candidates[0] = '\0';
   }
+
+  return true;
 }
 
 /**
- * Action matcher
+ * Channel profile
  *
- * Determines whether a given string represents and implemented action, and
- * returns a pointer to it.
+ * Looks up the profile named by the channel's profile_variable.
  *
- * @param action String to be matched
- * @return Pointer to matched action
+ * @param channel Channel (may be NULL)
+ * @return Profile configuration, NULL if none is selected
  */
-phonenumber_action_t pn_util_match_action_function(char *action)
+phonenumber_config_t *pn_util_channel_profile(switch_channel_t *channel)
 {
-  if (!strncasecmp(action, PN_ACTION_IS_ALPHA_NUMBER, PN_ACTION_LEN_IS_ALPHA_NUMBER)) {
-    return is_alpha_number;
-  } else if (!strncasecmp(action, PN_ACTION_CONVERT_ALPHA_CHARACTERS_IN_NUMBER, PN_ACTION_LEN_CONVERT_ALPHA_CHARACTERS_IN_NUMBER)) {
-    return convert_alpha_characters_in_number;
-  } else if (!strncasecmp(action, PN_ACTION_NORMALIZE_DIGITS_ONLY, PN_ACTION_LEN_NORMALIZE_DIGITS_ONLY)) {
-    return normalize_digits_only;
-  } else if (!strncasecmp(action, PN_ACTION_NORMALIZE_DIALLABLE_CHARS_ONLY, PN_ACTION_LEN_NORMALIZE_DIALLABLE_CHARS_ONLY)) {
-    return normalize_diallable_chars_only;
-  } else if (!strncasecmp(action, PN_ACTION_GET_NATIONAL_SIGNIFICANT_NUMBER, PN_ACTION_LEN_GET_NATIONAL_SIGNIFICANT_NUMBER)) {
-    return get_national_significant_number;
-  } else if (!strncasecmp(action, PN_ACTION_FORMAT_OUT_OF_COUNTRY_CALLING_NUMBER, PN_ACTION_LEN_FORMAT_OUT_OF_COUNTRY_CALLING_NUMBER)) {
-    return format_out_of_country_calling_number;
-  } else if (!strncasecmp(action, PN_ACTION_FORMAT, PN_ACTION_LEN_FORMAT)) {
-    return format;
-  } else if (!strncasecmp(action, PN_ACTION_GET_NUMBER_TYPE, PN_ACTION_LEN_GET_NUMBER_TYPE)) {
-    return get_number_type;
-  } else if (!strncasecmp(action, PN_ACTION_IS_VALID_NUMBER_FOR_REGION, PN_ACTION_LEN_IS_VALID_NUMBER_FOR_REGION)) {
-    return is_valid_number_for_region;
-  } else if (!strncasecmp(action, PN_ACTION_GET_REGION_CODE, PN_ACTION_LEN_GET_REGION_CODE)) {
-    return get_region_code;
-  } else if (!strncasecmp(action, PN_ACTION_IS_POSSIBLE_NUMBER_WITH_REASON, PN_ACTION_LEN_IS_POSSIBLE_NUMBER_WITH_REASON)) {
-    return is_possible_number_with_reason;
-  } else if (!strncasecmp(action, PN_ACTION_IS_POSSIBLE_NUMBER, PN_ACTION_LEN_IS_POSSIBLE_NUMBER)) {
-    return is_possible_number;
-  } else if (!strncasecmp(action, PN_ACTION_GET_DESCRIPTION_FOR_NUMBER, PN_ACTION_LEN_GET_DESCRIPTION_FOR_NUMBER)) {
-    return get_description_for_number;
-  } else {
+  const char *name;
+
+  if (!channel || !mod_phonenumber_profile_variable || !mod_phonenumber_profiles_index) {
+    return NULL;
+  }
+
+  if (zstr(name = switch_channel_get_variable(channel, mod_phonenumber_profile_variable))) {
     return NULL;
   }
+
+  return (phonenumber_config_t *)switch_core_hash_find(mod_phonenumber_profiles_index, name);
 }
 
 /**
- * Format matcher
+ * Guard parser
  *
- * Matches a string representing a phone number format to its libphonenumber
- * representation. If no match is found, it falls back to the configured
- * default.
+ * Compiles a guard condition (without its leading PN_GUARD_PREFIX), e.g.
+ * "valid", "!possible", "type=MOBILE|FIXED_LINE_OR_MOBILE" or "region=GB|IE".
  *
- * @param format String to match
- * @return libphonenumber format
+ * @param str Condition to be parsed
+ * @param step Step to compile the guard into
+ * @return Whether or not the condition is valid
  */
-PhoneNumberUtil::PhoneNumberFormat pn_util_str_to_format(char *format)
+static bool pn_util_parse_guard(char *str, phonenumber_step_t *step)
 {
-  if (zstr(format))
-    return mod_phonenumber_config.format;
+  int argc, i;
+  char *argv[PN_GUARD_MAX_REGIONS + 1] = { NULL };
+  PhoneNumberUtil::PhoneNumberType type;
 
-  if (!strncasecmp(format, PN_FORMAT_E164, PN_FORMAT_LEN_E164)) {
-    return PhoneNumberUtil::E164;
-  } else if (!strncasecmp(format, PN_FORMAT_INTERNATIONAL, PN_FORMAT_LEN_INTERNATIONAL)) {
-    return PhoneNumberUtil::INTERNATIONAL;
-  } else if (!strncasecmp(format, PN_FORMAT_NATIONAL, PN_FORMAT_LEN_NATIONAL)) {
-    return PhoneNumberUtil::NATIONAL;
-  } else if (!strncasecmp(format, PN_FORMAT_RFC3966, PN_FORMAT_LEN_RFC3966)) {
-    return PhoneNumberUtil::RFC3966;
+  step->action = NULL;
+  step->negate = false;
+  step->types = 0;
+  step->regionc = 0;
+
+  if (*str == PN_GUARD_NEGATE) {
+    step->negate = true;
+    str++;
+  }
+
+  if (!strcasecmp(str, PN_GUARD_VALID)) {
+    step->guard = phonenumber_guard::GUARD_VALID;
+  } else if (!strcasecmp(str, PN_GUARD_POSSIBLE)) {
+    step->guard = phonenumber_guard::GUARD_POSSIBLE;
+  } else if (!strncasecmp(str, PN_GUARD_TYPE, PN_GUARD_LEN_TYPE)) {
+    step->guard = phonenumber_guard::GUARD_TYPE;
+    argc = switch_separate_string(str + PN_GUARD_LEN_TYPE, PN_GUARD_SEPARATOR, argv, (sizeof(argv) / sizeof(argv[0])));
+
+    for (i = 0; i < argc; i++) {
+      type = pn_util_str_to_type(argv[i]);
+
+      if (strcasecmp(argv[i], pn_util_type_to_str(type))) {
+        return false;
+      }
+
+      step->types |= 1U << type;
+    }
+
+    return step->types != 0;
+  } else if (!strncasecmp(str, PN_GUARD_REGION, PN_GUARD_LEN_REGION)) {
+    step->guard = phonenumber_guard::GUARD_REGION;
+    argc = switch_separate_string(str + PN_GUARD_LEN_REGION, PN_GUARD_SEPARATOR, argv, (sizeof(argv) / sizeof(argv[0])));
+
+    if (argc > PN_GUARD_MAX_REGIONS) {
+      return false;
+    }
+
+    for (i = 0; i < argc; i++) {
+      if (strlen(argv[i]) != 2) {
+        return false;
+      }
+
+      step->regions[i][0] = toupper(argv[i][0]);
+      step->regions[i][1] = toupper(argv[i][1]);
+      step->regions[i][2] = '\0';
+    }
+
+    step->regionc = (uint8_t)argc;
+
+    return argc > 0;
   } else {
-    return mod_phonenumber_config.format;
+    return false;
   }
+
+  return true;
 }
 
 /**
- * Format string converter
+ * Guard evaluator
  *
- * Converts a libphonenumber format to its string representation.
- *
- * @param format libphonenumber format
- * @return String representation
+ * @param step Guard step
+ * @param request Request (with a parsed number) to evaluate the guard on
+ * @return Whether or not the guard holds
+ */
+static bool pn_util_eval_guard(phonenumber_step_t *step, phonenumber_request_t *request)
+{
+  string region_code;
+  bool holds = true;
+  int i;
+
+  switch (step->guard) {
+  case phonenumber_guard::GUARD_VALID:
+    holds = phone_util.IsValidNumber(*(request->parsed));
+    break;
+  case phonenumber_guard::GUARD_POSSIBLE:
+    holds = pn_util_is_possible(*(request->parsed));
+    break;
+  case phonenumber_guard::GUARD_TYPE:
+    holds = (step->types & (1U << phone_util.GetNumberType(*(request->parsed)))) != 0;
+    break;
+  case phonenumber_guard::GUARD_REGION:
+    phone_util.GetRegionCodeForNumber(*(request->parsed), &region_code);
+    holds = false;
+    for (i = 0; (i < step->regionc) && !holds; i++) {
+      holds = !strcmp(step->regions[i], region_code.c_str());
+    }
+    break;
+  default:
+    break;
+  }
+
+  return holds != step->negate;
+}
+
+/**
+ * Action parser
+ *
+ * Parses out actions passed when the module is invoked via the dialplan
+ * application, through the API or configured for hooks, and compiles them
+ * (along with their guards) into a program run by pn_util_exec. An invalid
+ * guard discards the whole program, the actions it guards must not run
+ * unconditionally.
+ *
+ * @param str String to be parsed
+ * @return Array of parsed steps, terminated by an empty one
+ */
+phonenumber_step_t *pn_util_parse_actions(char *str)
+{
+  int actc, i, j = 0;
+  char *actv[PN_MAX_ACTIONS] = { NULL };
+  phonenumber_step_t *actions = (phonenumber_step_t *)malloc(sizeof(phonenumber_step_t) * (PN_MAX_ACTIONS + 1));
+
+  if (!actions) {
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_CRIT, "Unable to parse the actions, possibly OOM!\n");
+    return NULL;
+  }
+
+  if (!(actc = switch_separate_string(str, ',', actv, PN_MAX_ACTIONS))) {
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Cannot parse out any actions: %s\n", str);
+  } else {
+    for (i = 0; i < actc; i++) {
+      if (*actv[i] == PN_GUARD_PREFIX) {
+        if (!pn_util_parse_guard(actv[i] + 1, &actions[j])) {
+          switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Invalid guard: %s, discarding the actions\n", actv[i]);
+          j = 0;
+          break;
+        }
+
+        j++;
+        continue;
+      }
+
+      actions[j].action = pn_util_match_action_function(actv[i]);
+      actions[j].guard = phonenumber_guard::GUARD_NONE;
+
+      if (!actions[j].action) {
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Unknown action: %s\n", actv[i]);
+      } else {
+        j++;
+      }
+    }
+  }
+
+  actions[j].action = NULL;
+  actions[j].guard = phonenumber_guard::GUARD_NONE;
+
+  return actions;
+}
+
+/**
+ * Empty program check
+ *
+ * @param actions Array of parsed steps
+ * @return Whether or not there is no action to run
+ */
+bool pn_util_actions_empty(phonenumber_step_t *actions)
+{
+  int i;
+
+  if (!actions) {
+    return true;
+  }
+
+  for (i = 0; actions[i].action || actions[i].guard; i++) {
+    if (actions[i].action) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/**
+ * Candidate regions parser
+ *
+ * Parses a number against the candidate default regions, in order, and
+ * stops at the first region the number is valid for. The input has already
+ * been prefiltered once; it is only parsed again when the candidate region
+ * has a different calling code than the region of the previous parse (e.g.
+ * US|CA|JM, all NANPA members, take a single parse) and the number did not
+ * carry its own calling code. When no region matches, the parse against the
+ * first one is kept.
+ *
+ * @param request Request (with candidate regions)
+ * @param number Receives the parsed number
+ * @param matched Receives the matching region, empty if none matched
+ * @return Parse error (as per the first region, unless one matched)
+ */
+static int pn_util_parse_candidates(phonenumber_request_t *request, PhoneNumber *number, char *matched)
+{
+  const char *candidates = request->config->candidates;
+  PhoneNumber other, *current = number;
+  int i, cc, parsed_cc = 0, error = PhoneNumberUtil::NO_PARSING_ERROR, first_error = PhoneNumberUtil::NO_PARSING_ERROR;
+  bool own_cc = false;
+  char region[3];
+
+  matched[0] = '\0';
+
+  for (i = 0; *candidates; i++, candidates += (candidates[2] == PN_REGION_SEPARATOR) ? 3 : 2) {
+    region[0] = candidates[0];
+    region[1] = candidates[1];
+    region[2] = '\0';
+    cc = phone_util.GetCountryCodeForRegion(region);
+
+    if (!i || (!own_cc && (cc != parsed_cc))) {
+      current = i ? &other : number;
+      error = phone_util.Parse(request->number, region, current);
+      parsed_cc = cc;
+      own_cc = (error == PhoneNumberUtil::NO_PARSING_ERROR) && (current->country_code() != cc);
+
+      if (!i) {
+        first_error = error;
+      }
+    }
+
+    if ((error == PhoneNumberUtil::NO_PARSING_ERROR) && phone_util.IsValidNumberForRegion(*current, region)) {
+      strcpy(matched, region);
+
+      if (current != number) {
+        *number = *current;
+      }
+
+      return PhoneNumberUtil::NO_PARSING_ERROR;
+    }
+  }
+
+  return first_error;
+}
+
+/**
+ * Number parser
+ *
+ * Prefilters the request's number and parses it against the default region
+ * or, when configured, the candidate regions.
+ *
+ * @param request Request
+ * @param number Receives the parsed number
+ * @param matched Receives the matching candidate region, empty if none
+ * @return Rejection reason or parse error
+ */
+int pn_util_parse(phonenumber_request_t *request, PhoneNumber *number, char *matched)
+{
+  int error;
+
+  matched[0] = '\0';
+
+  if ((error = pn_util_prefilter(request->number))) {
+    return error;
+  }
+
+  if (request->config->candidates[0]) {
+    return pn_util_parse_candidates(request, number, matched);
+  }
+
+  return phone_util.Parse(request->number, request->config->default_region, number);
+}
+
+/**
+ * Action executor
+ *
+ * Executes an array of actions over a request; as soon as a guard does not
+ * hold, the remaining actions are skipped.
+ *
+ * @param actions Array of parsed steps
+ * @param request Request to action on
+ */
+void pn_util_exec(phonenumber_step_t *actions, phonenumber_request_t *request)
+{
+  int actc = 0, error = PhoneNumberUtil::NO_PARSING_ERROR;
+  bool parse = false;
+  bool guarded = false;
+  bool tracing = pn_trace_enabled();
+  bool caching = false;
+  bool candidates = false;
+  phonenumber_config_t *config = request->config, winner;
+  char matched[3] = "";
+  phonenumber_trace_t trace;
+  phonenumber_memo_t *memo = NULL, *other;
+  phonenumber_capture_t cached[PN_MAX_ACTIONS], capture;
+  phonenumber_action_t action;
+  char key[PN_CACHE_KEY_LEN];
+  uint64_t pending = 0, done = 0, bit;
+  PhoneNumber parsed;
+
+  if (request->channel && request->prefix) {
+    switch_channel_set_variable_name_printf(request->channel, request->number, "phonenumber_%s_input", request->prefix);
+  }
+
+  if (actions) {
+    if (request->channel && request->prefix && !request->stream && request->number) {
+      memo = pn_util_memo_get(request);
+    }
+
+    caching = request->number && pn_cache_enabled() && pn_cache_key(request, key);
+
+    for (actc = 0; (action = actions[actc].action) || actions[actc].guard; actc++) {
+      cached[actc].set = false;
+
+      if (!action) {
+        guarded = true;
+        continue;
+      }
+
+      bit = 1ULL << pn_util_action_to_id(action);
+
+      /* Recorded runs must produce every result, not only the missing ones */
+      if (!memo || request->record || !(memo->done & bit)) {
+        pending |= bit;
+
+        if (pn_util_action_requires_parse(action)) {
+          candidates = candidates || config->candidates[0];
+
+          if (!caching || !pn_util_action_is_cacheable(action) || !pn_cache_get(key, pn_util_action_to_id(action), &cached[actc])) {
+            parse = true;
+          }
+        }
+      }
+    }
+
+    if (!pending) {
+      switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "phonenumber_%s_* already computed for %s\n", request->prefix, request->number);
+      return;
+    }
+
+    PN_PROBE2(request__start, PN_PROBE_PREFIX(request), PN_PROBE_NUMBER_LEN(request));
+
+    /* Guards are evaluated against the parsed number, the candidate regions
+     * need it to tell which region matched (cached results or not) */
+    if (guarded || candidates) {
+      parse = true;
+    }
+
+    if (pn_top_enabled()) {
+      pn_top_update(request->prefix, request->number);
+    }
+
+    request->parsed = NULL;
+    request->capture = NULL;
+
+    if (tracing) {
+      pn_trace_begin(&trace, request);
+    }
+
+    if (!request->number) {
+      error = PN_REJECT_EMPTY;
+    } else if (parse && memo && memo->parsed) {
+      error = memo->error;
+      request->parsed = &memo->number_parsed;
+      strcpy(matched, memo->matched_region);
+    } else if (parse) {
+      PN_PROBE2(parse__start, PN_PROBE_PREFIX(request), PN_PROBE_NUMBER_LEN(request));
+
+      request->parsed = memo ? &memo->number_parsed : &parsed;
+      error = pn_util_parse(request, request->parsed, matched);
+
+      if (memo) {
+        memo->parsed = true;
+        memo->error = error;
+        strcpy(memo->matched_region, matched);
+      }
+
+      PN_PROBE3(parse__done, PN_PROBE_PREFIX(request), PN_PROBE_NUMBER_LEN(request), error);
+
+      if (tracing) {
+        pn_trace_parse(&trace, error);
+      }
+    }
+
+    if (error != PhoneNumberUtil::NO_PARSING_ERROR) {
+      pn_util_set_error(request, error);
+    } else {
+      if (request->channel && request->prefix) {
+        switch_channel_set_variable_name_printf(request->channel, NULL, "phonenumber_%s_error", request->prefix);
+      }
+
+      /* The actions run once, against the winning region */
+      if (candidates) {
+        pn_util_emit(request, "matched_region", matched[0] ? matched : PN_UNKNOWN_REGION);
+
+        winner = *config;
+        if (matched[0]) {
+          strcpy(winner.default_region, matched);
+        }
+        request->config = &winner;
+      }
+
+      for (actc = 0; (action = actions[actc].action) || actions[actc].guard; actc++) {
+        if (!action) {
+          if (!pn_util_eval_guard(&actions[actc], request)) {
+            switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "Guard #%d does not hold for %s, skipping the remaining actions\n", actc, request->number);
+            break;
+          }
+
+          continue;
+        }
+
+        bit = 1ULL << pn_util_action_to_id(action);
+
+        if (!memo || (pending & bit)) {
+          PN_PROBE3(action__start, PN_PROBE_PREFIX(request), pn_util_action_to_id(action), PN_PROBE_NUMBER_LEN(request));
+
+          if (cached[actc].set) {
+            pn_util_emit(request, cached[actc].suffix, cached[actc].value);
+          } else if (caching && pn_util_action_is_cacheable(action)) {
+            capture.set = false;
+            request->capture = &capture;
+            action(request);
+            request->capture = NULL;
+
+            pn_cache_put(key, pn_util_action_to_id(action), &capture);
+          } else {
+            action(request);
+          }
+
+          done |= bit;
+
+          PN_PROBE3(action__done, PN_PROBE_PREFIX(request), pn_util_action_to_id(action), PN_PROBE_NUMBER_LEN(request));
+
+          if (tracing) {
+            pn_trace_action(&trace, action);
+          }
+        }
+      }
+
+      if (memo) {
+        memo->done |= done;
+
+        /* The same variables now hold results for this input/configuration */
+        for (other = (phonenumber_memo_t *)switch_channel_get_private(request->channel, PN_MEMO_PRIVATE); other; other = other->next) {
+          if ((other != memo) && !strcmp(other->prefix, memo->prefix)) {
+            other->done &= ~done;
+          }
+        }
+      }
+    }
+
+    request->parsed = NULL;
+    request->config = config;
+
+    PN_PROBE3(request__done, PN_PROBE_PREFIX(request), PN_PROBE_NUMBER_LEN(request), error);
+
+    if (tracing) {
+      pn_trace_end(&trace);
+    }
+  }
+}
+
+/**
+ * Result emitter
+ *
+ * Publishes an action's result as the phonenumber_<prefix>_<suffix> channel
+ * variable (respectively event header) and/or as a line on the output
+ * stream; when the request is being captured (for caching purposes), the
+ * result is recorded as well, same as for propagating hooks (as
+ * "<suffix>=<value>" lines).
+ *
+ * @param request Request
+ * @param suffix Channel variable suffix
+ * @param value Result
+ */
+void pn_util_emit(phonenumber_request_t *request, const char *suffix, const char *value)
+{
+  if (request->channel) {
+    switch_channel_set_variable_name_printf(request->channel, value, "phonenumber_%s_%s", request->prefix, suffix);
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "phonenumber_%s_%s := %s\n", request->prefix, suffix, value);
+  }
+
+  if (request->stream) {
+    request->stream->write_function(request->stream, "%s\n", value);
+  }
+
+  if (request->record) {
+    request->record->write_function(request->record, "%s=%s\n", suffix, value);
+  }
+
+  if (request->event) {
+    char name[128];
+
+    switch_snprintf(name, sizeof(name), "phonenumber_%s_%s", request->prefix, suffix);
+    switch_event_del_header(request->event, name);
+    switch_event_add_header_string(request->event, SWITCH_STACK_BOTTOM, name, value);
+  }
+
+  if (request->capture) {
+    request->capture->overflow = request->capture->set || (strlen(suffix) >= PN_CACHE_SUFFIX_LEN) || (strlen(value) >= PN_CACHE_VALUE_LEN);
+    request->capture->set = true;
+
+    if (!request->capture->overflow) {
+      strcpy(request->capture->suffix, suffix);
+      strcpy(request->capture->value, value);
+    }
+  }
+}
+
+/**
+ * Session memo lookup
+ *
+ * Finds (or creates) the channel's memo entry for the request's prefix, number
+ * and configuration, which records the parsed number and the actions whose
+ * results are already stored in the channel variables.
+ *
+ * @param request Channel bound request
+ * @return Memo entry, or NULL if the channel already tracks PN_MEMO_MAX entries
+ */
+static phonenumber_memo_t *pn_util_memo_get(phonenumber_request_t *request)
+{
+  phonenumber_memo_t *head = (phonenumber_memo_t *)switch_channel_get_private(request->channel, PN_MEMO_PRIVATE);
+  phonenumber_memo_t *memo = head;
+  phonenumber_config_t *config = request->config;
+  int count = 0;
+
+  for (; memo; memo = memo->next, count++) {
+    if (!strcmp(memo->number, request->number) && !strcmp(memo->prefix, request->prefix) && (memo->config.format == config->format) &&
+        !strcmp(memo->config.default_region, config->default_region) && !strcmp(memo->config.candidates, config->candidates) &&
+        !strcmp(memo->config.locale, config->locale) && !strcmp(memo->config.calling_from, config->calling_from) && !strcmp(memo->config.list, config->list) &&
+        !strcmp(memo->config.translation, config->translation)) {
+      return memo;
+    }
+  }
+
+  if (count >= PN_MEMO_MAX) {
+    return NULL;
+  }
+
+  memo = new phonenumber_memo_t;
+  switch_strdup(memo->prefix, request->prefix);
+  switch_strdup(memo->number, request->number);
+  memo->config = *config;
+  memo->parsed = false;
+  memo->error = PhoneNumberUtil::NO_PARSING_ERROR;
+  memo->matched_region[0] = '\0';
+  memo->done = 0;
+  memo->next = head;
+
+  switch_channel_set_private(request->channel, PN_MEMO_PRIVATE, memo);
+
+  return memo;
+}
+
+/**
+ * Session memo cleanup
+ *
+ * Releases the channel's memo entries; invoked when the session is destroyed.
+ *
+ * @param channel Channel
+ */
+void pn_util_memo_destroy(switch_channel_t *channel)
+{
+  phonenumber_memo_t *memo = (phonenumber_memo_t *)switch_channel_get_private(channel, PN_MEMO_PRIVATE), *next;
+
+  switch_channel_set_private(channel, PN_MEMO_PRIVATE, NULL);
+
+  for (; memo; memo = next) {
+    next = memo->next;
+    switch_safe_free(memo->prefix);
+    switch_safe_free(memo->number);
+    delete memo;
+  }
+}
+
+/**
+ * Configuration signature
+ *
+ * Fingerprints a configuration along with what it applies to, e.g. a hook's
+ * actions or, for a hook following the channel's profile, the hook's own
+ * signature.
+ *
+ * @param base Fingerprinted along with the configuration
+ * @param config Configuration
+ * @param signature Output buffer, at least PN_SIGNATURE_LEN bytes long
+ */
+void pn_util_signature(const char *base, const phonenumber_config_t *config, char *signature)
+{
+  char *str = switch_mprintf("%s|%s|%s|%d|%s|%s|%s|%s", base, config->default_region, config->candidates, config->format, config->locale, config->calling_from,
+                             config->list, config->translation);
+
+  switch_snprintf(signature, PN_SIGNATURE_LEN, "%016" PRIx64, str ? pn_util_hash(str) : 0);
+  switch_safe_free(str);
+}
+
+/**
+ * String hash
+ *
+ * 64-bit FNV-1a, used wherever the module needs a cheap, stable fingerprint of
+ * a string.
+ *
+ * @param str String to hash
+ * @return Hash value
+ */
+uint64_t pn_util_hash(const char *str)
+{
+  uint64_t hash = 0xcbf29ce484222325ULL;
+
+  while (*str) {
+    hash ^= (unsigned char)*str++;
+    hash *= 0x100000001b3ULL;
+  }
+
+  return hash;
+}
+
+/**
+ * Input prefilter
+ *
+ * Cheap screening of the raw input before it is handed over to
+ * phone_util.Parse(), meant to weed out the typical junk caller IDs
+ * ("anonymous", "unknown", empty strings, SIP URIs etc.) without running the
+ * full parser on them. Any non-ASCII byte is assumed to be part of a UTF-8
+ * encoded digit or punctuation mark and left for the parser to judge.
+ *
+ * @param number Raw input
+ * @return 0 if the input is worth parsing, a PN_REJECT_* code otherwise
+ */
+int pn_util_prefilter(const char *number)
+{
+  static const char *sentinels[] = { "anonymous", "unknown", "restricted", "private", "unavailable", NULL };
+  const unsigned char *c = (const unsigned char *)number;
+  bool digits = false;
+  size_t length = 0;
+  int i;
+
+  if (zstr(number)) {
+    return PN_REJECT_EMPTY;
+  }
+
+  for (i = 0; sentinels[i]; i++) {
+    if (!strcasecmp(number, sentinels[i])) {
+      return PN_REJECT_SENTINEL;
+    }
+  }
+
+  if (!strncasecmp(number, "sip:", 4) || !strncasecmp(number, "sips:", 5)) {
+    return PN_REJECT_URI;
+  }
+
+  for (; *c; c++, length++) {
+    if ((*c >= '0' && *c <= '9') || (*c >= 0x80)) {
+      digits = true;
+    } else if (*c == '@') {
+      return PN_REJECT_URI;
+    } else if ((*c < 0x20) || (*c == 0x7f)) {
+      return PN_REJECT_INVALID_CHARACTERS;
+    }
+  }
+
+  if (length > PN_MAX_INPUT_LEN) {
+    return PN_REJECT_TOO_LONG;
+  }
+
+  if (!digits) {
+    return PN_REJECT_NO_DIGITS;
+  }
+
+  return 0;
+}
+
+/**
+ * Error reporting
+ *
+ * Reports a rejected or unparseable input, in place of the requested actions'
+ * results; sets the phonenumber_<prefix>_error channel variable and/or writes
+ * an -ERR line to the output stream.
+ *
+ * @param request Failed request
+ * @param error Parse return code or PN_REJECT_* code
+ */
+void pn_util_set_error(phonenumber_request_t *request, int error)
+{
+  const char *response = pn_util_error_to_str(error);
+
+  if (request->channel && request->prefix) {
+    switch_channel_set_variable_name_printf(request->channel, response, "phonenumber_%s_error", request->prefix);
+    switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_DEBUG, "phonenumber_%s_error := %s\n", request->prefix, response);
+  }
+
+  if (request->stream) {
+    request->stream->write_function(request->stream, "-ERR %s\n", response);
+  }
+
+  if (request->record) {
+    request->record->write_function(request->record, "error=%s\n", response);
+  }
+
+  if (request->event && request->prefix) {
+    char name[128];
+
+    switch_snprintf(name, sizeof(name), "phonenumber_%s_error", request->prefix);
+    switch_event_del_header(request->event, name);
+    switch_event_add_header_string(request->event, SWITCH_STACK_BOTTOM, name, response);
+  }
+}
+
+/**
+ * Action matcher
+ *
+ * Determines whether a given string represents and implemented action, and
+ * returns a pointer to it.
+ *
+ * @param action String to be matched
+ * @return Pointer to matched action
+ */
+phonenumber_action_t pn_util_match_action_function(char *action)
+{
+  if (!strncasecmp(action, PN_ACTION_IS_ALPHA_NUMBER, PN_ACTION_LEN_IS_ALPHA_NUMBER)) {
+    return is_alpha_number;
+  } else if (!strncasecmp(action, PN_ACTION_CONVERT_ALPHA_CHARACTERS_IN_NUMBER, PN_ACTION_LEN_CONVERT_ALPHA_CHARACTERS_IN_NUMBER)) {
+    return convert_alpha_characters_in_number;
+  } else if (!strncasecmp(action, PN_ACTION_NORMALIZE_DIGITS_ONLY, PN_ACTION_LEN_NORMALIZE_DIGITS_ONLY)) {
+    return normalize_digits_only;
+  } else if (!strncasecmp(action, PN_ACTION_NORMALIZE_DIALLABLE_CHARS_ONLY, PN_ACTION_LEN_NORMALIZE_DIALLABLE_CHARS_ONLY)) {
+    return normalize_diallable_chars_only;
+  } else if (!strncasecmp(action, PN_ACTION_GET_NATIONAL_SIGNIFICANT_NUMBER, PN_ACTION_LEN_GET_NATIONAL_SIGNIFICANT_NUMBER)) {
+    return get_national_significant_number;
+  } else if (!strncasecmp(action, PN_ACTION_FORMAT_OUT_OF_COUNTRY_CALLING_NUMBER, PN_ACTION_LEN_FORMAT_OUT_OF_COUNTRY_CALLING_NUMBER)) {
+    return format_out_of_country_calling_number;
+  } else if (!strncasecmp(action, PN_ACTION_FORMAT, PN_ACTION_LEN_FORMAT)) {
+    return format;
+  } else if (!strncasecmp(action, PN_ACTION_GET_NUMBER_TYPE, PN_ACTION_LEN_GET_NUMBER_TYPE)) {
+    return get_number_type;
+  } else if (!strncasecmp(action, PN_ACTION_IS_VALID_NUMBER_FOR_REGION, PN_ACTION_LEN_IS_VALID_NUMBER_FOR_REGION)) {
+    return is_valid_number_for_region;
+  } else if (!strncasecmp(action, PN_ACTION_IS_VALID_NUMBER, PN_ACTION_LEN_IS_VALID_NUMBER)) {
+    return is_valid_number;
+  } else if (!strncasecmp(action, PN_ACTION_GET_REGION_CODE, PN_ACTION_LEN_GET_REGION_CODE)) {
+    return get_region_code;
+  } else if (!strncasecmp(action, PN_ACTION_IS_POSSIBLE_NUMBER_WITH_REASON, PN_ACTION_LEN_IS_POSSIBLE_NUMBER_WITH_REASON)) {
+    return is_possible_number_with_reason;
+  } else if (!strncasecmp(action, PN_ACTION_IS_POSSIBLE_NUMBER, PN_ACTION_LEN_IS_POSSIBLE_NUMBER)) {
+    return is_possible_number;
+  } else if (!strncasecmp(action, PN_ACTION_GET_DESCRIPTION_FOR_NUMBER, PN_ACTION_LEN_GET_DESCRIPTION_FOR_NUMBER)) {
+    return get_description_for_number;
+  } else if (!strncasecmp(action, PN_ACTION_EXTRACT, PN_ACTION_LEN_EXTRACT)) {
+    return extract;
+  } else if (!strncasecmp(action, PN_ACTION_IS_LISTED, PN_ACTION_LEN_IS_LISTED)) {
+    return is_listed;
+  } else if (!strncasecmp(action, PN_ACTION_KEY, PN_ACTION_LEN_KEY)) {
+    return key;
+  } else if (!strncasecmp(action, PN_ACTION_TRANSLATE, PN_ACTION_LEN_TRANSLATE)) {
+    return translate;
+  } else {
+    return NULL;
+  }
+}
+
+/**
+ * Action parse requirement
+ *
+ * Determines whether an action operates on the parsed phone number or only on
+ * the raw input string; the latter group does not need pn_util_exec to invoke
+ * phone_util.Parse beforehand.
+ *
+ * @param action Action to be checked
+ * @return Whether the action needs the parsed number
+ */
+bool pn_util_action_requires_parse(phonenumber_action_t action)
+{
+  if ((action == is_alpha_number) || (action == convert_alpha_characters_in_number) ||
+      (action == normalize_digits_only) || (action == normalize_diallable_chars_only) ||
+      (action == extract)) {
+    return false;
+  }
+
+  return true;
+}
+
+/**
+ * Action cacheability
+ *
+ * Determines whether an action's results may be kept in the shared lookup
+ * cache, i.e. they only depend on the parsed number and the configuration
+ * (list membership changes on reload, hence it is never cached; translations
+ * depend on the selected rule set, which is not part of the cache key).
+ *
+ * @param action Action to be checked
+ * @return Whether the action's results are cacheable
+ */
+bool pn_util_action_is_cacheable(phonenumber_action_t action)
+{
+  return pn_util_action_requires_parse(action) && (action != is_listed) && (action != translate);
+}
+
+/**
+ * Action identifier
+ *
+ * Maps an action function to its numeric identifier (as used by tracing).
+ *
+ * @param action Action function
+ * @return Action identifier, ACTION_UNKNOWN if there is no match
+ */
+phonenumber_action_id pn_util_action_to_id(phonenumber_action_t action)
+{
+  if (action == is_alpha_number) {
+    return phonenumber_action_id::ACTION_IS_ALPHA_NUMBER;
+  } else if (action == convert_alpha_characters_in_number) {
+    return phonenumber_action_id::ACTION_CONVERT_ALPHA_CHARACTERS_IN_NUMBER;
+  } else if (action == normalize_digits_only) {
+    return phonenumber_action_id::ACTION_NORMALIZE_DIGITS_ONLY;
+  } else if (action == normalize_diallable_chars_only) {
+    return phonenumber_action_id::ACTION_NORMALIZE_DIALLABLE_CHARS_ONLY;
+  } else if (action == get_national_significant_number) {
+    return phonenumber_action_id::ACTION_GET_NATIONAL_SIGNIFICANT_NUMBER;
+  } else if (action == format_out_of_country_calling_number) {
+    return phonenumber_action_id::ACTION_FORMAT_OUT_OF_COUNTRY_CALLING_NUMBER;
+  } else if (action == format) {
+    return phonenumber_action_id::ACTION_FORMAT;
+  } else if (action == get_number_type) {
+    return phonenumber_action_id::ACTION_GET_NUMBER_TYPE;
+  } else if (action == is_valid_number_for_region) {
+    return phonenumber_action_id::ACTION_IS_VALID_NUMBER_FOR_REGION;
+  } else if (action == get_region_code) {
+    return phonenumber_action_id::ACTION_GET_REGION_CODE;
+  } else if (action == is_possible_number_with_reason) {
+    return phonenumber_action_id::ACTION_IS_POSSIBLE_NUMBER_WITH_REASON;
+  } else if (action == is_possible_number) {
+    return phonenumber_action_id::ACTION_IS_POSSIBLE_NUMBER;
+  } else if (action == get_description_for_number) {
+    return phonenumber_action_id::ACTION_GET_DESCRIPTION_FOR_NUMBER;
+  } else if (action == extract) {
+    return phonenumber_action_id::ACTION_EXTRACT;
+  } else if (action == is_listed) {
+    return phonenumber_action_id::ACTION_IS_LISTED;
+  } else if (action == is_valid_number) {
+    return phonenumber_action_id::ACTION_IS_VALID_NUMBER;
+  } else if (action == key) {
+    return phonenumber_action_id::ACTION_KEY;
+  } else if (action == translate) {
+    return phonenumber_action_id::ACTION_TRANSLATE;
+  } else {
+    return phonenumber_action_id::ACTION_UNKNOWN;
+  }
+}
+
+/**
+ * Action string converter
+ *
+ * Converts an action identifier to the action's name.
+ *
+ * @param id Action identifier
+ * @return Action name
+ */
+const char *pn_util_action_id_to_str(phonenumber_action_id id)
+{
+  switch (id) {
+  case phonenumber_action_id::ACTION_IS_ALPHA_NUMBER:
+    return PN_ACTION_IS_ALPHA_NUMBER;
+  case phonenumber_action_id::ACTION_CONVERT_ALPHA_CHARACTERS_IN_NUMBER:
+    return PN_ACTION_CONVERT_ALPHA_CHARACTERS_IN_NUMBER;
+  case phonenumber_action_id::ACTION_NORMALIZE_DIGITS_ONLY:
+    return PN_ACTION_NORMALIZE_DIGITS_ONLY;
+  case phonenumber_action_id::ACTION_NORMALIZE_DIALLABLE_CHARS_ONLY:
+    return PN_ACTION_NORMALIZE_DIALLABLE_CHARS_ONLY;
+  case phonenumber_action_id::ACTION_GET_NATIONAL_SIGNIFICANT_NUMBER:
+    return PN_ACTION_GET_NATIONAL_SIGNIFICANT_NUMBER;
+  case phonenumber_action_id::ACTION_FORMAT_OUT_OF_COUNTRY_CALLING_NUMBER:
+    return PN_ACTION_FORMAT_OUT_OF_COUNTRY_CALLING_NUMBER;
+  case phonenumber_action_id::ACTION_FORMAT:
+    return PN_ACTION_FORMAT;
+  case phonenumber_action_id::ACTION_GET_NUMBER_TYPE:
+    return PN_ACTION_GET_NUMBER_TYPE;
+  case phonenumber_action_id::ACTION_IS_VALID_NUMBER_FOR_REGION:
+    return PN_ACTION_IS_VALID_NUMBER_FOR_REGION;
+  case phonenumber_action_id::ACTION_GET_REGION_CODE:
+    return PN_ACTION_GET_REGION_CODE;
+  case phonenumber_action_id::ACTION_IS_POSSIBLE_NUMBER_WITH_REASON:
+    return PN_ACTION_IS_POSSIBLE_NUMBER_WITH_REASON;
+  case phonenumber_action_id::ACTION_IS_POSSIBLE_NUMBER:
+    return PN_ACTION_IS_POSSIBLE_NUMBER;
+  case phonenumber_action_id::ACTION_GET_DESCRIPTION_FOR_NUMBER:
+    return PN_ACTION_GET_DESCRIPTION_FOR_NUMBER;
+  case phonenumber_action_id::ACTION_EXTRACT:
+    return PN_ACTION_EXTRACT;
+  case phonenumber_action_id::ACTION_IS_LISTED:
+    return PN_ACTION_IS_LISTED;
+  case phonenumber_action_id::ACTION_IS_VALID_NUMBER:
+    return PN_ACTION_IS_VALID_NUMBER;
+  case phonenumber_action_id::ACTION_KEY:
+    return PN_ACTION_KEY;
+  case phonenumber_action_id::ACTION_TRANSLATE:
+    return PN_ACTION_TRANSLATE;
+  default:
+    return PN_EMPTY;
+  }
+}
+
+/**
+ * Parse error string converter
+ *
+ * Converts a phone_util.Parse() return code or a prefilter rejection code to
+ * its string representation; a negative value stands for a number which has
+ * not been parsed at all.
+ *
+ * @param error Parse return code or PN_REJECT_* code
+ * @return String representation
+ */
+const char *pn_util_error_to_str(int error)
+{
+  if (error < 0)
+    return PN_ERROR_NOT_PARSED;
+
+  switch (error) {
+  case PhoneNumberUtil::NO_PARSING_ERROR:
+    return PN_ERROR_NONE;
+  case PhoneNumberUtil::INVALID_COUNTRY_CODE_ERROR:
+    return PN_ERROR_INVALID_COUNTRY_CODE;
+  case PhoneNumberUtil::NOT_A_NUMBER:
+    return PN_ERROR_NOT_A_NUMBER;
+  case PhoneNumberUtil::TOO_SHORT_AFTER_IDD:
+    return PN_ERROR_TOO_SHORT_AFTER_IDD;
+  case PhoneNumberUtil::TOO_SHORT_NSN:
+    return PN_ERROR_TOO_SHORT_NSN;
+  case PhoneNumberUtil::TOO_LONG_NSN:
+    return PN_ERROR_TOO_LONG_NSN;
+  case PN_REJECT_EMPTY:
+    return PN_ERROR_EMPTY;
+  case PN_REJECT_SENTINEL:
+    return PN_ERROR_SENTINEL;
+  case PN_REJECT_TOO_LONG:
+    return PN_ERROR_TOO_LONG;
+  case PN_REJECT_NO_DIGITS:
+    return PN_ERROR_NO_DIGITS;
+  case PN_REJECT_URI:
+    return PN_ERROR_URI;
+  case PN_REJECT_INVALID_CHARACTERS:
+    return PN_ERROR_INVALID_CHARACTERS;
+  default:
+    return PN_ERROR_NOT_A_NUMBER;
+  }
+}
+
+/**
+ * Possible lengths
+ *
+ * Bitmask of the national significant number lengths deemed possible for
+ * every country calling code (bit n set for n digits), 0 for unassigned
+ * codes. Built once at load from libphonenumber's metadata, so the
+ * plausibility check boils down to a table lookup.
+ */
+static uint32_t mod_phonenumber_possible_lengths[PN_MAX_COUNTRY_CODE + 1];
+
+/**
+ * Possible lengths setup
+ *
+ * Probes every country calling code with one number of each length; the
+ * possible length rules only depend on the country code and the length of
+ * the national significant number, so the outcome holds for any number.
+ */
+void pn_util_lengths_init()
+{
+  PhoneNumber probe;
+  string region_code;
+  uint64_t national_number;
+  int cc, length;
+
+  memset(mod_phonenumber_possible_lengths, 0, sizeof(mod_phonenumber_possible_lengths));
+
+  for (cc = 1; cc <= PN_MAX_COUNTRY_CODE; cc++) {
+    phone_util.GetRegionCodeForCountryCode(cc, &region_code);
+
+    if (region_code == PN_UNKNOWN_REGION) {
+      continue;
+    }
+
+    probe.Clear();
+    probe.set_country_code(cc);
+
+    for (length = 1, national_number = 1; length <= PN_MAX_NSN_LEN; length++, national_number *= 10) {
+      probe.set_national_number(national_number);
+
+      if (phone_util.IsPossibleNumber(probe)) {
+        mod_phonenumber_possible_lengths[cc] |= 1U << length;
+      }
+    }
+  }
+}
+
+/**
+ * Possibility check
+ *
+ * Equivalent of PhoneNumberUtil::IsPossibleNumber, backed by the possible
+ * length tables.
+ *
+ * @param number Parsed number
+ * @return Whether or not the number has a possible length for its country code
+ */
+bool pn_util_is_possible(const PhoneNumber &number)
+{
+  uint64_t nn = number.national_number();
+  int cc = number.country_code(), length = 0;
+
+  if ((cc < 1) || (cc > PN_MAX_COUNTRY_CODE)) {
+    return false;
+  }
+
+  if (number.italian_leading_zero() && (number.number_of_leading_zeros() > 0)) {
+    length = number.number_of_leading_zeros();
+  }
+
+  do {
+    length++;
+    nn /= 10;
+  } while (nn);
+
+  return (length <= PN_MAX_NSN_LEN) && (mod_phonenumber_possible_lengths[cc] & (1U << length));
+}
+
+/**
+ * Number key packer
+ *
+ * Packs a parsed number into its canonical 64-bit key (see PN_KEY_*), i.e.
+ * the same information E.164 carries, as an integer downstream systems can
+ * index and join on.
+ *
+ * @param number Parsed number
+ * @param key Packed key
+ * @return Whether or not the number fits the key layout
+ */
+bool pn_util_pack_key(const PhoneNumber &number, phonenumber_key_t *key)
+{
+  uint64_t zeros = 0;
+  int cc = number.country_code();
+
+  if ((cc < 1) || (cc > PN_MAX_COUNTRY_CODE) || (number.national_number() > PN_KEY_NN_MASK)) {
+    return false;
+  }
+
+  if (number.italian_leading_zero() && (number.number_of_leading_zeros() > 0)) {
+    if (number.number_of_leading_zeros() > PN_KEY_MAX_ZEROS) {
+      return false;
+    }
+
+    zeros = number.number_of_leading_zeros();
+  }
+
+  *key = ((uint64_t)cc << PN_KEY_CC_SHIFT) | (zeros << PN_KEY_ZEROS_SHIFT) | number.national_number();
+
+  return true;
+}
+
+/**
+ * E.164 formatter
+ *
+ * Writes the E.164 representation of a parsed number straight from its
+ * fields, producing the exact same output as PhoneNumberUtil::Format without
+ * its intermediate strings. Numbers without a national number part are
+ * formatted as their raw input, as libphonenumber does.
+ *
+ * @param number Parsed number
+ * @param buf Output buffer
+ * @param len Output buffer size
+ * @return Whether or not the number fit in the buffer
+ */
+bool pn_util_format_e164(const PhoneNumber &number, char *buf, size_t len)
+{
+  char digits[20];
+  uint64_t nn = number.national_number();
+  uint32_t cc = number.country_code();
+  int zeros, d = 0;
+  size_t i = 0;
+
+  if (!nn && !number.raw_input().empty()) {
+    if (number.raw_input().size() >= len) {
+      return false;
+    }
+
+    memcpy(buf, number.raw_input().data(), number.raw_input().size() + 1);
+    return true;
+  }
+
+  if (cc > 999) {
+    return false;
+  }
+
+  zeros = (number.italian_leading_zero() && (number.number_of_leading_zeros() > 0)) ? number.number_of_leading_zeros() : 0;
+
+  do {
+    digits[d++] = '0' + (nn % 10);
+    nn /= 10;
+  } while (nn);
+
+  /* +, country code (at most 3 digits), zeros, national number, NUL */
+  if ((5 + (size_t)zeros + d) > len) {
+    return false;
+  }
+
+  buf[i++] = '+';
+
+  if (cc >= 100) {
+    buf[i++] = '0' + (cc / 100) % 10;
+  }
+
+  if (cc >= 10) {
+    buf[i++] = '0' + (cc / 10) % 10;
+  }
+
+  buf[i++] = '0' + cc % 10;
+
+  while (zeros-- > 0) {
+    buf[i++] = '0';
+  }
+
+  while (d) {
+    buf[i++] = digits[--d];
+  }
+
+  buf[i] = '\0';
+
+  return true;
+}
+
+/**
+ * Format matcher
+ *
+ * Matches a string representing a phone number format to its libphonenumber
+ * representation. If no match is found, it falls back to the configured
+ * default.
+ *
+ * @param format String to match
+ * @return libphonenumber format
+ */
+PhoneNumberUtil::PhoneNumberFormat pn_util_str_to_format(char *format)
+{
+  if (zstr(format))
+    return mod_phonenumber_config.format;
+
+  if (!strncasecmp(format, PN_FORMAT_E164, PN_FORMAT_LEN_E164)) {
+    return PhoneNumberUtil::E164;
+  } else if (!strncasecmp(format, PN_FORMAT_INTERNATIONAL, PN_FORMAT_LEN_INTERNATIONAL)) {
+    return PhoneNumberUtil::INTERNATIONAL;
+  } else if (!strncasecmp(format, PN_FORMAT_NATIONAL, PN_FORMAT_LEN_NATIONAL)) {
+    return PhoneNumberUtil::NATIONAL;
+  } else if (!strncasecmp(format, PN_FORMAT_RFC3966, PN_FORMAT_LEN_RFC3966)) {
+    return PhoneNumberUtil::RFC3966;
+  } else {
+    return mod_phonenumber_config.format;
+  }
+}
+
+/**
+ * Format string converter
+ *
+ * Converts a libphonenumber format to its string representation.
+ *
+ * @param format libphonenumber format
+ * @return String representation
  */
 const char *pn_util_format_to_str(PhoneNumberUtil::PhoneNumberFormat format)
 {
@@ -469,3 +2027,193 @@ const char *pn_util_direction_to_str(phonenumber_direction direction)
     return PN_ALL;
   }
 }
+
+/**
+ * Phase matcher
+ *
+ * Matches a string representing a hook phase (init, routing or reporting) to
+ * its internal representation. If no match is possible, it defaults to init.
+ *
+ * @param phase String to match
+ * @return Internal representation
+ */
+phonenumber_phase pn_util_str_to_phase(char *phase)
+{
+  if (zstr(phase))
+    return phonenumber_phase::PHASE_INIT;
+
+  if (!strncasecmp(phase, PN_ROUTING, PN_LEN_ROUTING)) {
+    return phonenumber_phase::PHASE_ROUTING;
+  } else if (!strncasecmp(phase, PN_REPORTING, PN_LEN_REPORTING)) {
+    return phonenumber_phase::PHASE_REPORTING;
+  } else {
+    return phonenumber_phase::PHASE_INIT;
+  }
+}
+
+/**
+ * Phase string converter
+ *
+ * Converts a hook phase's internal representation to a string.
+ *
+ * @param phase Internal phase representation
+ * @return String representation
+ */
+const char *pn_util_phase_to_str(phonenumber_phase phase)
+{
+  switch (phase) {
+  case phonenumber_phase::PHASE_ROUTING:
+    return PN_ROUTING;
+  case phonenumber_phase::PHASE_REPORTING:
+    return PN_REPORTING;
+  default:
+    return PN_INIT;
+  }
+}
+
+/**
+ * Number type matcher
+ *
+ * Matches a string representing a phone number type (e.g. MOBILE) to its
+ * libphonenumber representation. If no match is possible, it defaults to
+ * UNKNOWN.
+ *
+ * @param type String to match
+ * @return libphonenumber type
+ */
+PhoneNumberUtil::PhoneNumberType pn_util_str_to_type(const char *type)
+{
+  if (zstr(type))
+    return PhoneNumberUtil::UNKNOWN;
+
+  if (!strcasecmp(type, PN_TYPE_FIXED_LINE)) {
+    return PhoneNumberUtil::FIXED_LINE;
+  } else if (!strcasecmp(type, PN_TYPE_MOBILE)) {
+    return PhoneNumberUtil::MOBILE;
+  } else if (!strcasecmp(type, PN_TYPE_FIXED_LINE_OR_MOBILE)) {
+    return PhoneNumberUtil::FIXED_LINE_OR_MOBILE;
+  } else if (!strcasecmp(type, PN_TYPE_TOLL_FREE)) {
+    return PhoneNumberUtil::TOLL_FREE;
+  } else if (!strcasecmp(type, PN_TYPE_PREMIUM_RATE)) {
+    return PhoneNumberUtil::PREMIUM_RATE;
+  } else if (!strcasecmp(type, PN_TYPE_SHARED_COST)) {
+    return PhoneNumberUtil::SHARED_COST;
+  } else if (!strcasecmp(type, PN_TYPE_VOIP)) {
+    return PhoneNumberUtil::VOIP;
+  } else if (!strcasecmp(type, PN_TYPE_PERSONAL_NUMBER)) {
+    return PhoneNumberUtil::PERSONAL_NUMBER;
+  } else if (!strcasecmp(type, PN_TYPE_PAGER)) {
+    return PhoneNumberUtil::PAGER;
+  } else if (!strcasecmp(type, PN_TYPE_UAN)) {
+    return PhoneNumberUtil::UAN;
+  } else if (!strcasecmp(type, PN_TYPE_VOICEMAIL)) {
+    return PhoneNumberUtil::VOICEMAIL;
+  } else {
+    return PhoneNumberUtil::UNKNOWN;
+  }
+}
+
+/**
+ * Number type string converter
+ *
+ * Converts a libphonenumber phone number type to its string representation.
+ *
+ * @param type libphonenumber type
+ * @return String representation
+ */
+const char *pn_util_type_to_str(PhoneNumberUtil::PhoneNumberType type)
+{
+  switch (type) {
+  case PhoneNumberUtil::FIXED_LINE:
+    return PN_TYPE_FIXED_LINE;
+  case PhoneNumberUtil::FIXED_LINE_OR_MOBILE:
+    return PN_TYPE_FIXED_LINE_OR_MOBILE;
+  case PhoneNumberUtil::MOBILE:
+    return PN_TYPE_MOBILE;
+  case PhoneNumberUtil::PAGER:
+    return PN_TYPE_PAGER;
+  case PhoneNumberUtil::PERSONAL_NUMBER:
+    return PN_TYPE_PERSONAL_NUMBER;
+  case PhoneNumberUtil::PREMIUM_RATE:
+    return PN_TYPE_PREMIUM_RATE;
+  case PhoneNumberUtil::SHARED_COST:
+    return PN_TYPE_SHARED_COST;
+  case PhoneNumberUtil::TOLL_FREE:
+    return PN_TYPE_TOLL_FREE;
+  case PhoneNumberUtil::UAN:
+    return PN_TYPE_UAN;
+  case PhoneNumberUtil::VOICEMAIL:
+    return PN_TYPE_VOICEMAIL;
+  case PhoneNumberUtil::VOIP:
+    return PN_TYPE_VOIP;
+  default:
+    return PN_TYPE_UNKNOWN;
+  }
+}
+
+/**
+ * Route key builder
+ *
+ * Composes the index key of a routing rule out of its region code, number
+ * type and validity components.
+ *
+ * @param key Output buffer, at least PN_ROUTE_KEY_LEN bytes long
+ * @param region Region code or PN_ROUTE_ANY
+ * @param type Number type or PN_ROUTE_ANY
+ * @param valid Validity ("true"/"false") or PN_ROUTE_ANY
+ */
+void pn_util_route_key(char *key, const char *region, const char *type, const char *valid)
+{
+  snprintf(key, PN_ROUTE_KEY_LEN, "%s:%s:%s", region, type, valid);
+}
+
+/**
+ * Rule matcher
+ *
+ * Looks up the most specific rule for a number's region code, type and
+ * validity in a rule index (routes or a translation's rules). At most eight
+ * hash lookups are performed (exact match first, then with progressively more
+ * wildcards), regardless of how many rules are configured.
+ *
+ * @param index Rule index, keyed by pn_util_route_key
+ * @param region Region code of the number
+ * @param type Type of the number
+ * @param valid Whether the number is valid
+ * @return Matching rule or NULL if there is none
+ */
+void *pn_util_match_rule(switch_hash_t *index, const char *region, const char *type, bool valid)
+{
+  const char *regions[2] = { region, PN_ROUTE_ANY };
+  const char *types[2] = { type, PN_ROUTE_ANY };
+  const char *validity[2] = { valid ? "true" : "false", PN_ROUTE_ANY };
+  char key[PN_ROUTE_KEY_LEN];
+  void *rule;
+  int i;
+
+  if (!index) {
+    return NULL;
+  }
+
+  for (i = 0; i < 8; i++) {
+    pn_util_route_key(key, regions[(i >> 2) & 1], types[(i >> 1) & 1], validity[i & 1]);
+
+    if ((rule = switch_core_hash_find(index, key))) {
+      return rule;
+    }
+  }
+
+  return NULL;
+}
+
+/**
+ * Route matcher
+ *
+ * @param region Region code of the number
+ * @param type Type of the number
+ * @param valid Whether the number is valid
+ * @return Matching route or NULL if there is none
+ */
+phonenumber_route_t *pn_util_match_route(const char *region, const char *type, bool valid)
+{
+  return (phonenumber_route_t *)pn_util_match_rule(mod_phonenumber_routes_index, region, type, valid);
+}
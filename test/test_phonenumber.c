@@ -30,6 +30,15 @@
   }                                                                                                         \
   stream.end = stream.data;
 
+static char async_result[256];
+
+static void async_result_handler(switch_event_t *event)
+{
+  const char *body = switch_event_get_body(event);
+
+  switch_copy_string(async_result, body ? body : "", sizeof(async_result));
+}
+
 FST_CORE_BEGIN("conf")
 {
   FST_MODULE_BEGIN(mod_phonenumber, mod_phonenumber_test)
@@ -137,6 +146,210 @@ FST_CORE_BEGIN("conf")
     }
     FST_TEST_END()
 
+    FST_TEST_BEGIN(format_e164)
+    {
+      switch_stream_handle_t stream = { 0 };
+
+      SWITCH_STANDARD_STREAM(stream);
+
+      /* Direct E.164 writer, exact output (Italian leading zeros, non-geographical, extensions) */
+      switch_api_execute("phonenumber", "format '+39 06 6988 4857' format=E164", NULL, &stream);
+      fst_check_string_equals(stream.data, "+390669884857\n");
+      stream.end = stream.data;
+
+      switch_api_execute("phonenumber", "format '+800 1234 5678' format=E164", NULL, &stream);
+      fst_check_string_equals(stream.data, "+80012345678\n");
+      stream.end = stream.data;
+
+      switch_api_execute("phonenumber", "format '+1 617-253-1000 ext. 1234' format=E164", NULL, &stream);
+      fst_check_string_equals(stream.data, "+16172531000\n");
+      stream.end = stream.data;
+
+      switch_api_execute("phonenumber", "format '+1 617-253-1000 ext. 1234' format=RFC3966", NULL, &stream);
+      fst_check_string_equals(stream.data, "tel:+1-617-253-1000;ext=1234\n");
+
+      switch_safe_free(stream.data);
+    }
+    FST_TEST_END()
+
+    FST_TEST_BEGIN(region_candidates)
+    {
+      switch_core_session_t *session = NULL;
+      switch_call_cause_t cause = SWITCH_CAUSE_NONE;
+      switch_channel_t *channel;
+      switch_stream_handle_t stream = { 0 };
+
+      SWITCH_STANDARD_STREAM(stream);
+
+      /* The matched region comes first, the actions run against it */
+      switch_api_execute("phonenumber", "is_valid_number_for_region 4169671111 default_region=US|CA", NULL, &stream);
+      fst_check_string_equals(stream.data, "CA\ntrue\n");
+      stream.end = stream.data;
+
+      switch_api_execute("phonenumber", "is_valid_number_for_region,format 6172531000 default_region=GB|US", NULL, &stream);
+      fst_check_string_equals(stream.data, "US\ntrue\n+16172531000\n");
+      stream.end = stream.data;
+
+      switch_api_execute("phonenumber", "is_valid_number_for_region +442076792000 default_region=US|CA", NULL, &stream);
+      fst_check_string_equals(stream.data, "ZZ\nfalse\n");
+      stream.end = stream.data;
+
+      /* Unknown codes reject the whole list, the configured default region stays */
+      switch_api_execute("phonenumber", "is_valid_number_for_region 4169671111 default_region=CA|XX", NULL, &stream);
+      fst_check_string_equals(stream.data, "false\n");
+      stream.end = stream.data;
+
+      /* Raw input actions do not need a region */
+      switch_api_execute("phonenumber", "normalize_digits_only 416-967-1111 default_region=US|CA", NULL, &stream);
+      fst_check_string_equals(stream.data, "4169671111\n");
+
+      fst_requires_module("mod_loopback");
+
+      fst_requires(switch_ivr_originate(NULL, &session, &cause, "loopback/4169671111/load", 10, NULL, NULL, NULL, NULL, NULL, SOF_NONE, NULL, NULL) ==
+                   SWITCH_STATUS_SUCCESS);
+      channel = switch_core_session_get_channel(session);
+
+      switch_core_session_execute_application(session, "phonenumber", "get_region_code destination default_region=US|CA|JM");
+      fst_check_string_equals(switch_channel_get_variable(channel, "phonenumber_destination_matched_region"), "CA");
+      fst_check_string_equals(switch_channel_get_variable(channel, "phonenumber_destination_region_code"), "CA");
+
+      switch_channel_hangup(channel, SWITCH_CAUSE_NORMAL_CLEARING);
+      switch_core_session_rwunlock(session);
+      switch_safe_free(stream.data);
+    }
+    FST_TEST_END()
+
+    FST_TEST_BEGIN(chat)
+    {
+      switch_event_t *message = NULL;
+
+      fst_requires(switch_event_create(&message, SWITCH_EVENT_MESSAGE) == SWITCH_STATUS_SUCCESS);
+      switch_event_add_header_string(message, SWITCH_STACK_BOTTOM, "from", "6172531000@sms.example.com");
+      switch_event_add_header_string(message, SWITCH_STACK_BOTTOM, "from_user", "(617) 253-1000");
+      switch_event_add_header_string(message, SWITCH_STACK_BOTTOM, "to", "sip:+44 20 7679 2000@sms.example.com");
+
+      fst_check(switch_core_execute_chat_app(message, "phonenumber", "default_region=US") == SWITCH_STATUS_SUCCESS);
+
+      fst_check_string_equals(switch_event_get_header(message, "from_user"), "+16172531000");
+      fst_check_string_equals(switch_event_get_header(message, "from"), "+16172531000@sms.example.com");
+      fst_check_string_equals(switch_event_get_header(message, "phonenumber_from_region_code"), "US");
+      fst_check_string_equals(switch_event_get_header(message, "phonenumber_from_number_type"), "FIXED_LINE_OR_MOBILE");
+      fst_check_string_equals(switch_event_get_header(message, "to_user"), "+442076792000");
+      fst_check_string_equals(switch_event_get_header(message, "to"), "sip:+442076792000@sms.example.com");
+      fst_check_string_equals(switch_event_get_header(message, "phonenumber_to_region_code"), "GB");
+      switch_event_destroy(&message);
+
+      /* Other formats do not fit in an address, only the headers are added */
+      fst_requires(switch_event_create(&message, SWITCH_EVENT_MESSAGE) == SWITCH_STATUS_SUCCESS);
+      switch_event_add_header_string(message, SWITCH_STACK_BOTTOM, "from", "sip:6172531000@sms.example.com");
+
+      fst_check(switch_core_execute_chat_app(message, "phonenumber", "default_region=US,format=NATIONAL") == SWITCH_STATUS_SUCCESS);
+
+      fst_check_string_equals(switch_event_get_header(message, "from"), "sip:6172531000@sms.example.com");
+      fst_check(switch_event_get_header(message, "from_user") == NULL);
+      fst_check_string_equals(switch_event_get_header(message, "phonenumber_from_format"), "(617) 253-1000");
+      fst_check_string_equals(switch_event_get_header(message, "phonenumber_from_region_code"), "US");
+      switch_event_destroy(&message);
+
+      /* Unparsable addresses are left alone, even with stale results around */
+      fst_requires(switch_event_create(&message, SWITCH_EVENT_MESSAGE) == SWITCH_STATUS_SUCCESS);
+      switch_event_add_header_string(message, SWITCH_STACK_BOTTOM, "from", "anonymous@sms.example.com");
+      switch_event_add_header_string(message, SWITCH_STACK_BOTTOM, "phonenumber_from_format", "+16172531000");
+
+      fst_check(switch_core_execute_chat_app(message, "phonenumber", NULL) == SWITCH_STATUS_SUCCESS);
+
+      fst_check_string_equals(switch_event_get_header(message, "from"), "anonymous@sms.example.com");
+      fst_check(switch_event_get_header(message, "phonenumber_from_error") != NULL);
+      fst_check(switch_event_get_header(message, "phonenumber_from_format") == NULL);
+      switch_event_destroy(&message);
+
+      /* Running twice does not duplicate the results */
+      fst_requires(switch_event_create(&message, SWITCH_EVENT_MESSAGE) == SWITCH_STATUS_SUCCESS);
+      switch_event_add_header_string(message, SWITCH_STACK_BOTTOM, "from", "6172531000@sms.example.com");
+
+      fst_check(switch_core_execute_chat_app(message, "phonenumber", "default_region=US") == SWITCH_STATUS_SUCCESS);
+      fst_check(switch_core_execute_chat_app(message, "phonenumber", "default_region=US") == SWITCH_STATUS_SUCCESS);
+
+      {
+        switch_event_header_t *hp;
+        int count = 0;
+
+        for (hp = message->headers; hp; hp = hp->next) {
+          count += !strcmp(hp->name, "phonenumber_from_region_code");
+        }
+
+        fst_check(count == 1);
+      }
+
+      fst_check_string_equals(switch_event_get_header(message, "from"), "+16172531000@sms.example.com");
+      switch_event_destroy(&message);
+    }
+    FST_TEST_END()
+
+    FST_TEST_BEGIN(key)
+    {
+      switch_stream_handle_t stream = { 0 };
+
+      SWITCH_STANDARD_STREAM(stream);
+
+      switch_api_execute("phonenumber", "key +16172531000", NULL, &stream);
+      fst_check_string_equals(stream.data, "18014404682012984\n");
+      stream.end = stream.data;
+
+      /* Same number, different spelling */
+      switch_api_execute("phonenumber", "key '(617) 253-1000' default_region=US", NULL, &stream);
+      fst_check_string_equals(stream.data, "18014404682012984\n");
+      stream.end = stream.data;
+
+      /* The Italian leading zero is part of the key */
+      switch_api_execute("phonenumber", "key '+39 06 6988 4857'", NULL, &stream);
+      fst_check_string_equals(stream.data, "704813342353367481\n");
+      stream.end = stream.data;
+
+      switch_api_execute("phonenumber", "key 02076792000 default_region=GB", NULL, &stream);
+      fst_check_string_equals(stream.data, "792633536493999296\n");
+
+      switch_safe_free(stream.data);
+    }
+    FST_TEST_END()
+
+    FST_TEST_BEGIN(translate)
+    {
+      switch_stream_handle_t stream = { 0 };
+
+      SWITCH_STANDARD_STREAM(stream);
+
+      /* Region specific rule: national significant number behind the trunk prefix */
+      switch_api_execute("phonenumber", "translate '020 7679 2000' default_region=GB,translation=national", NULL, &stream);
+      fst_check_string_equals(stream.data, "02076792000\n");
+      stream.end = stream.data;
+
+      /* Catch-all rule: dialed from GB, digits only */
+      switch_api_execute("phonenumber", "translate +16172531000 translation=national", NULL, &stream);
+      fst_check_string_equals(stream.data, "0016172531000\n");
+      stream.end = stream.data;
+
+      /* Rule set bound to a profile */
+      switch_api_execute("phonenumber", "translate +16172531000 profile=uk", NULL, &stream);
+      fst_check_string_equals(stream.data, "0016172531000\n");
+      stream.end = stream.data;
+
+      switch_api_execute("phonenumber", "translate '(617) 253-1000' translation=e164", NULL, &stream);
+      fst_check_string_equals(stream.data, "+16172531000\n");
+      stream.end = stream.data;
+
+      /* No rule for invalid numbers, respectively unknown rule set */
+      switch_api_execute("phonenumber", "translate +12005550100 translation=e164", NULL, &stream);
+      fst_check_string_equals(stream.data, "\n");
+      stream.end = stream.data;
+
+      switch_api_execute("phonenumber", "translate +16172531000 translation=unknown", NULL, &stream);
+      fst_check_string_equals(stream.data, "\n");
+
+      switch_safe_free(stream.data);
+    }
+    FST_TEST_END()
+
     FST_TEST_BEGIN(format_out_of_country_calling_number)
     {
       switch_stream_handle_t stream = { 0 };
@@ -198,6 +411,8 @@ FST_CORE_BEGIN("conf")
       PN_EXPECT("phonenumber", "get_region_code +442076792000 default_region=US", "GB");
       PN_EXPECT("phonenumber", "get_region_code 6172531000 default_region=US", "US");
       PN_EXPECT("phonenumber", "get_region_code 6172531000 default_region=GB", "ZZ");
+      PN_EXPECT("phonenumber", "get_region_code +442076792000 default_region=ZZ", "GB");
+      PN_EXPECT("phonenumber", "get_region_code 6172531000 default_region=ZZ", "-ERR INVALID_COUNTRY_CODE");
 
       switch_safe_free(stream.data);
     }
@@ -211,7 +426,7 @@ FST_CORE_BEGIN("conf")
 
       PN_EXPECT("phonenumber", "is_possible_number_with_reason +16172531000", "IS_POSSIBLE");
       PN_EXPECT("phonenumber", "is_possible_number_with_reason 253-1000", "IS_POSSIBLE");
-      PN_EXPECT("phonenumber", "is_possible_number_with_reason +999237000", "INVALID_COUNTRY_CODE");
+      PN_EXPECT("phonenumber", "is_possible_number_with_reason +999237000", "-ERR INVALID_COUNTRY_CODE");
       PN_EXPECT("phonenumber", "is_possible_number_with_reason +1256300", "TOO_SHORT");
       PN_EXPECT("phonenumber", "is_possible_number_with_reason 077400982200 default_region=IT", "TOO_LONG");
 
@@ -226,9 +441,43 @@ FST_CORE_BEGIN("conf")
       SWITCH_STANDARD_STREAM(stream);
 
       PN_EXPECT("phonenumber", "is_possible_number +16172531000", "true");
-      PN_EXPECT("phonenumber", "is_possible_number +999237000", "false");
+      PN_EXPECT("phonenumber", "is_possible_number +999237000", "-ERR INVALID_COUNTRY_CODE");
       PN_EXPECT("phonenumber", "is_possible_number +1256300", "false");
       PN_EXPECT("phonenumber", "is_possible_number 077400982200 default_region=IT", "false");
+      PN_EXPECT("phonenumber", "is_possible_number +11111111111", "true");
+
+      switch_safe_free(stream.data);
+    }
+    FST_TEST_END()
+
+    FST_TEST_BEGIN(is_valid_number)
+    {
+      switch_stream_handle_t stream = { 0 };
+
+      SWITCH_STANDARD_STREAM(stream);
+
+      PN_EXPECT("phonenumber", "is_valid_number +16172531000", "true");
+      PN_EXPECT("phonenumber", "is_valid_number +11111111111", "false");
+      PN_EXPECT("phonenumber", "is_valid_number +1256300", "false");
+      PN_EXPECT("phonenumber", "is_valid_number +999237000", "-ERR INVALID_COUNTRY_CODE");
+
+      switch_safe_free(stream.data);
+    }
+    FST_TEST_END()
+
+    FST_TEST_BEGIN(prefilter)
+    {
+      switch_stream_handle_t stream = { 0 };
+
+      SWITCH_STANDARD_STREAM(stream);
+
+      PN_EXPECT("phonenumber", "format anonymous", "-ERR SENTINEL");
+      PN_EXPECT("phonenumber", "format Unavailable", "-ERR SENTINEL");
+      PN_EXPECT("phonenumber", "format caller", "-ERR NO_DIGITS");
+      PN_EXPECT("phonenumber", "format sip:16172531000@example.com", "-ERR URI");
+      PN_EXPECT("phonenumber", "format 16172531000@example.com", "-ERR URI");
+      PN_EXPECT("phonenumber", "format,get_region_code +16172531000", "+16172531000\nUS");
+      PN_EXPECT("phonenumber", "is_alpha_number anonymous", "false");
 
       switch_safe_free(stream.data);
     }
@@ -257,6 +506,471 @@ FST_CORE_BEGIN("conf")
     }
     FST_TEST_END()
 
+    FST_TEST_BEGIN(extract)
+    {
+      switch_stream_handle_t stream = { 0 };
+
+      SWITCH_STANDARD_STREAM(stream);
+
+      PN_EXPECT("phonenumber", "extract 'Call me at 617-253-1000 or +44 20 7679 2000'", "11-23 +16172531000");
+      PN_EXPECT("phonenumber", "extract 'Office: +44 20 7679 2000'", "8-24 +442076792000");
+      PN_EXPECT("phonenumber", "extract 'Büro: 030 34637000' default_region=DE", "7-19 +493034637000");
+      PN_EXPECT("phonenumber", "extract 'No numbers in here'", "");
+
+      switch_safe_free(stream.data);
+    }
+    FST_TEST_END()
+
+    FST_TEST_BEGIN(extract_windows)
+    {
+      switch_stream_handle_t stream = { 0 };
+      char *command = NULL, *c;
+      int i;
+
+      SWITCH_STANDARD_STREAM(stream);
+
+      /* Past PN_EXTRACT_CHUNK, with a two byte character straddling the
+       * 4096 bytes mark right before the second number */
+      fst_requires((command = (char *)malloc(8192)) != NULL);
+      c = command + sprintf(command, "extract 'Call 617-253-1000: ");
+      for (i = 0; i < 2039; i++) {
+        c += sprintf(c, "\xC3\xBC");
+      }
+      sprintf(c, " +44 20 7679 2000 gracias' default_region=US");
+
+      switch_api_execute("phonenumber", command, NULL, &stream);
+      fst_check_string_equals(stream.data, "5-17 +16172531000\n4098-4114 +442076792000\n");
+
+      switch_safe_free(command);
+      switch_safe_free(stream.data);
+    }
+    FST_TEST_END()
+
+    FST_TEST_BEGIN(trace_dump)
+    {
+      switch_stream_handle_t stream = { 0 };
+
+      SWITCH_STANDARD_STREAM(stream);
+
+      switch_api_execute("phonenumber", "get_region_code,format +442079460000", NULL, &stream);
+      stream.end = stream.data;
+
+      switch_api_execute("phonenumber", "trace dump", NULL, &stream);
+      fst_check(stream.data != NULL);
+      fst_check(strstr(stream.data, "'+442079460000' parse=NONE/") != NULL);
+      fst_check(strstr(stream.data, " get_region_code=") != NULL);
+      fst_check(strstr(stream.data, " format=") != NULL);
+      stream.end = stream.data;
+
+      PN_EXPECT("phonenumber", "trace bogus", "-ERR");
+
+      switch_safe_free(stream.data);
+    }
+    FST_TEST_END()
+
+    FST_TEST_BEGIN(memo)
+    {
+      switch_core_session_t *session = NULL;
+      switch_call_cause_t cause = SWITCH_CAUSE_NONE;
+      switch_channel_t *channel;
+      switch_stream_handle_t stream = { 0 };
+      char *last;
+
+      fst_requires_module("mod_loopback");
+      SWITCH_STANDARD_STREAM(stream);
+
+      fst_requires(switch_ivr_originate(NULL, &session, &cause, "{origination_caller_id_number=+442076792000}loopback/+16172531000/load", 10, NULL, NULL, NULL, NULL,
+                                        NULL, SOF_NONE, NULL, NULL) == SWITCH_STATUS_SUCCESS);
+      channel = switch_core_session_get_channel(session);
+
+      /* The CS_INIT hook already formatted the destination, only the description is pending */
+      switch_core_session_execute_application(session, "phonenumber", "format,get_description_for_number destination");
+      fst_check_string_equals(switch_channel_get_variable(channel, "phonenumber_destination_format"), "+16172531000");
+      fst_check_string_equals(switch_channel_get_variable(channel, "phonenumber_destination_description_for_number"), "Cambridge, MA");
+
+      switch_api_execute("phonenumber", "trace dump", NULL, &stream);
+      fst_requires(stream.data != NULL);
+      *((char *)stream.data + strlen(stream.data) - 1) = '\0';
+      last = strrchr(stream.data, '\n');
+      last = last ? last + 1 : stream.data;
+      fst_check(strstr(last, " get_description_for_number=") != NULL);
+      fst_check(strstr(last, " format=") == NULL);
+
+      switch_channel_hangup(channel, SWITCH_CAUSE_NORMAL_CLEARING);
+      switch_core_session_rwunlock(session);
+      switch_safe_free(stream.data);
+    }
+    FST_TEST_END()
+
+    FST_TEST_BEGIN(hook_predicates)
+    {
+      switch_core_session_t *session = NULL;
+      switch_call_cause_t cause = SWITCH_CAUSE_NONE;
+      switch_channel_t *channel;
+
+      fst_requires_module("mod_loopback");
+
+      fst_requires(switch_ivr_originate(NULL, &session, &cause, "{pn_test=yes}loopback/+16172531000/load", 10, NULL, NULL, NULL, NULL, NULL, SOF_NONE, NULL,
+                                        NULL) == SWITCH_STATUS_SUCCESS);
+      channel = switch_core_session_get_channel(session);
+
+      fst_check_string_equals(switch_channel_get_variable(channel, "phonenumber_destination_national_significant_number"), "6172531000");
+      fst_check(switch_channel_get_variable(channel, "phonenumber_destination_is_possible_number_with_reason") == NULL);
+      fst_check(switch_channel_get_variable(channel, "phonenumber_destination_out_of_country_calling_number") == NULL);
+
+      switch_channel_hangup(channel, SWITCH_CAUSE_NORMAL_CLEARING);
+      switch_core_session_rwunlock(session);
+    }
+    FST_TEST_END()
+
+    FST_TEST_BEGIN(hook_phases)
+    {
+      switch_core_session_t *session = NULL;
+      switch_call_cause_t cause = SWITCH_CAUSE_NONE;
+      switch_channel_t *channel;
+      int i;
+
+      fst_requires_module("mod_loopback");
+
+      fst_requires(switch_ivr_originate(NULL, &session, &cause, "loopback/+16172531000/load", 10, NULL, NULL, NULL, NULL, NULL, SOF_NONE, NULL, NULL) ==
+                   SWITCH_STATUS_SUCCESS);
+      channel = switch_core_session_get_channel(session);
+
+      /* The reporting hook is left alone at CS_INIT */
+      fst_check_string_equals(switch_channel_get_variable(channel, "phonenumber_destination_format"), "+16172531000");
+      fst_check(switch_channel_get_variable(channel, "phonenumber_destination_description_for_number") == NULL);
+
+      /* The session is not destroyed while we hold it, CS_REPORTING still runs */
+      switch_channel_hangup(channel, SWITCH_CAUSE_NORMAL_CLEARING);
+
+      for (i = 0; (i < 50) && !switch_channel_get_variable(channel, "phonenumber_destination_description_for_number"); i++) {
+        switch_yield(100000);
+      }
+
+      fst_check_string_equals(switch_channel_get_variable(channel, "phonenumber_destination_description_for_number"), "Cambridge, MA");
+      switch_core_session_rwunlock(session);
+    }
+    FST_TEST_END()
+
+    FST_TEST_BEGIN(propagate)
+    {
+      switch_core_session_t *session = NULL, *peer = NULL;
+      switch_call_cause_t cause = SWITCH_CAUSE_NONE;
+      switch_channel_t *channel, *peer_channel;
+      switch_event_header_t *hi;
+      char name[128] = "";
+
+      fst_requires_module("mod_loopback");
+
+      fst_requires(switch_ivr_originate(NULL, &session, &cause, "{origination_caller_id_number=+442076792000}loopback/+16172531000/load", 10, NULL, NULL, NULL,
+                                        NULL, NULL, SOF_NONE, NULL, NULL) == SWITCH_STATUS_SUCCESS);
+      channel = switch_core_session_get_channel(session);
+
+      /* The first hook records its results for the legs it originates */
+      if ((hi = switch_channel_variable_first(channel))) {
+        for (; hi; hi = hi->next) {
+          if (!strncmp(hi->name, "phonenumber_destination_propagate_", 34)) {
+            switch_copy_string(name, hi->name, sizeof(name));
+            fst_check(strstr(hi->value, "+16172531000\n") == hi->value);
+            fst_check(strstr(hi->value, "\nformat=+16172531000\n") != NULL);
+          }
+        }
+
+        switch_channel_variable_last(channel);
+      }
+
+      fst_requires(name[0] != '\0');
+
+      /* Doctored results show they are copied, not computed again */
+      switch_channel_set_variable(channel, name, "+16172531000\nformat=propagated\n");
+      fst_requires(switch_ivr_originate(session, &peer, &cause, "{origination_caller_id_number=+442076792000}loopback/+16172531000/load", 10, NULL, NULL, NULL,
+                                        NULL, NULL, SOF_NONE, NULL, NULL) == SWITCH_STATUS_SUCCESS);
+      peer_channel = switch_core_session_get_channel(peer);
+      fst_check_string_equals(switch_channel_get_variable(peer_channel, "phonenumber_destination_format"), "propagated");
+      fst_check_string_equals(switch_channel_get_variable(peer_channel, "phonenumber_destination_input"), "+16172531000");
+      fst_check(switch_channel_get_variable(peer_channel, "phonenumber_destination_region_code") == NULL);
+      fst_check_string_equals(switch_channel_get_variable(peer_channel, "phonenumber_caller_region_code"), "GB");
+      switch_channel_hangup(peer_channel, SWITCH_CAUSE_NORMAL_CLEARING);
+      switch_core_session_rwunlock(peer);
+
+      /* Results recorded for another input are not reused */
+      switch_channel_set_variable(channel, name, "+16172531001\nformat=propagated\n");
+      fst_requires(switch_ivr_originate(session, &peer, &cause, "{origination_caller_id_number=+442076792000}loopback/+16172531000/load", 10, NULL, NULL, NULL,
+                                        NULL, NULL, SOF_NONE, NULL, NULL) == SWITCH_STATUS_SUCCESS);
+      peer_channel = switch_core_session_get_channel(peer);
+      fst_check_string_equals(switch_channel_get_variable(peer_channel, "phonenumber_destination_format"), "+16172531000");
+      fst_check_string_equals(switch_channel_get_variable(peer_channel, "phonenumber_destination_region_code"), "US");
+      switch_channel_hangup(peer_channel, SWITCH_CAUSE_NORMAL_CLEARING);
+      switch_core_session_rwunlock(peer);
+
+      switch_channel_hangup(channel, SWITCH_CAUSE_NORMAL_CLEARING);
+      switch_core_session_rwunlock(session);
+    }
+    FST_TEST_END()
+
+    FST_TEST_BEGIN(dialplan)
+    {
+      switch_core_session_t *session = NULL, *routed = NULL;
+      switch_call_cause_t cause = SWITCH_CAUSE_NONE;
+      switch_channel_t *channel;
+      switch_dialplan_interface_t *dialplan;
+      switch_caller_extension_t *extension;
+      const char *uuid;
+
+      fst_requires_module("mod_loopback");
+
+      /* The loopback B-leg is routed by the matching rule */
+      fst_requires(switch_ivr_originate(NULL, &session, &cause, "loopback/+447400123456/load/phonenumber", 10, NULL, NULL, NULL, NULL, NULL, SOF_NONE, NULL,
+                                        NULL) == SWITCH_STATUS_SUCCESS);
+      channel = switch_core_session_get_channel(session);
+      fst_requires((uuid = switch_channel_get_variable(channel, "other_loopback_leg_uuid")) != NULL);
+      fst_requires((routed = switch_core_session_locate(uuid)) != NULL);
+      fst_check_string_equals(switch_channel_get_variable(switch_core_session_get_channel(routed), "pn_route"), "uk_mobile");
+      fst_check_string_equals(switch_channel_get_variable(switch_core_session_get_channel(routed), "phonenumber_destination_number_type"), "MOBILE");
+      switch_core_session_rwunlock(routed);
+      switch_channel_hangup(channel, SWITCH_CAUSE_NORMAL_CLEARING);
+      switch_core_session_rwunlock(session);
+
+      fst_requires((dialplan = switch_loadable_module_get_dialplan_interface("phonenumber")) != NULL);
+
+      fst_requires(switch_ivr_originate(NULL, &session, &cause, "loopback/+447400123456/load", 10, NULL, NULL, NULL, NULL, NULL, SOF_NONE, NULL, NULL) ==
+                   SWITCH_STATUS_SUCCESS);
+      extension = dialplan->hunt_function(session, NULL, NULL);
+      fst_requires(extension != NULL);
+      fst_check_string_equals(extension->applications->application_name, "set");
+      fst_check_string_equals(extension->applications->application_data, "pn_route=uk_mobile");
+      fst_check_string_equals(extension->applications->next->application_name, "answer");
+      fst_check_string_equals(extension->applications->next->next->application_name, "park");
+      switch_channel_hangup(switch_core_session_get_channel(session), SWITCH_CAUSE_NORMAL_CLEARING);
+      switch_core_session_rwunlock(session);
+
+      /* No rule for valid US numbers, the next dialplan is up */
+      fst_requires(switch_ivr_originate(NULL, &session, &cause, "loopback/+16172531000/load", 10, NULL, NULL, NULL, NULL, NULL, SOF_NONE, NULL, NULL) ==
+                   SWITCH_STATUS_SUCCESS);
+      channel = switch_core_session_get_channel(session);
+      fst_check(dialplan->hunt_function(session, NULL, NULL) == NULL);
+      fst_check_string_equals(switch_channel_get_variable(channel, "phonenumber_destination_region_code"), "US");
+      fst_check(switch_channel_get_variable(channel, "phonenumber_destination_error") == NULL);
+      switch_channel_hangup(channel, SWITCH_CAUSE_NORMAL_CLEARING);
+      switch_core_session_rwunlock(session);
+
+      /* Unparsable destinations do not reach the valid="false" rule */
+      fst_requires(switch_ivr_originate(NULL, &session, &cause, "loopback/abc/load", 10, NULL, NULL, NULL, NULL, NULL, SOF_NONE, NULL, NULL) ==
+                   SWITCH_STATUS_SUCCESS);
+      channel = switch_core_session_get_channel(session);
+      switch_channel_set_variable(channel, "phonenumber_destination_error", NULL);
+      fst_check(dialplan->hunt_function(session, NULL, NULL) == NULL);
+      fst_check(switch_channel_get_variable(channel, "phonenumber_destination_error") != NULL);
+      switch_channel_hangup(channel, SWITCH_CAUSE_NORMAL_CLEARING);
+      switch_core_session_rwunlock(session);
+
+      UNPROTECT_INTERFACE(dialplan);
+    }
+    FST_TEST_END()
+
+    FST_TEST_BEGIN(cache)
+    {
+      switch_stream_handle_t stream = { 0 };
+
+      SWITCH_STANDARD_STREAM(stream);
+
+      PN_EXPECT("phonenumber", "get_region_code,format '+44 20 7679 2000' format=NATIONAL", "GB\n020 7679 2000");
+      PN_EXPECT("phonenumber", "get_region_code,format +44-20-7679-2000 format=NATIONAL", "GB\n020 7679 2000");
+      PN_EXPECT("phonenumber", "get_region_code,format +442076792000 format=INTERNATIONAL", "GB\n+44 20 7679 2000");
+
+      switch_api_execute("phonenumber", "cache stats", NULL, &stream);
+      fst_check(stream.data != NULL);
+      fst_check(strstr(stream.data, "+OK private slots=4096 ") == stream.data);
+      fst_check(strstr(stream.data, " hits=0 ") == NULL);
+      stream.end = stream.data;
+
+      PN_EXPECT("phonenumber", "cache bogus", "-ERR");
+
+      switch_safe_free(stream.data);
+    }
+    FST_TEST_END()
+
+    FST_TEST_BEGIN(snapshot)
+    {
+      switch_stream_handle_t stream = { 0 };
+      const char *err = NULL;
+      char path[1024];
+      FILE *fp;
+      long size;
+      int i;
+
+      SWITCH_STANDARD_STREAM(stream);
+      switch_snprintf(path, sizeof(path), "%s%sphonenumber_test.snapshot", SWITCH_GLOBAL_dirs.temp_dir, SWITCH_PATH_SEPARATOR);
+
+      PN_EXPECT("phonenumber", "get_region_code +61293744000", "AU");
+
+      /* The module is reloaded, the calls of the previous tests must be gone */
+      for (i = 0; (i < 50) && switch_core_session_count(); i++) {
+        switch_yield(100000);
+      }
+
+      /* Written on shutdown, loaded back into the new (private) cache */
+      fst_requires(switch_loadable_module_unload_module((char *)"../.libs", (char *)"mod_phonenumber", SWITCH_FALSE, &err) == SWITCH_STATUS_SUCCESS);
+      fst_requires((fp = fopen(path, "rb")) != NULL);
+      fseek(fp, 0, SEEK_END);
+      size = ftell(fp);
+      fclose(fp);
+      fst_requires(size > 0);
+      fst_requires(switch_loadable_module_load_module((char *)"../.libs", (char *)"mod_phonenumber", SWITCH_FALSE, &err) == SWITCH_STATUS_SUCCESS);
+
+      PN_EXPECT("phonenumber", "get_region_code +61293744000", "AU");
+      PN_EXPECT("phonenumber", "cache stats", "+OK private slots=4096 hits=1 misses=0");
+
+      /* A snapshot with a foreign header is discarded */
+      fst_requires(switch_loadable_module_unload_module((char *)"../.libs", (char *)"mod_phonenumber", SWITCH_FALSE, &err) == SWITCH_STATUS_SUCCESS);
+      fst_requires((fp = fopen(path, "r+b")) != NULL);
+      fwrite("XXXX", 1, 4, fp);
+      fclose(fp);
+      fst_requires(switch_loadable_module_load_module((char *)"../.libs", (char *)"mod_phonenumber", SWITCH_FALSE, &err) == SWITCH_STATUS_SUCCESS);
+
+      PN_EXPECT("phonenumber", "get_region_code +61293744000", "AU");
+      PN_EXPECT("phonenumber", "cache stats", "+OK private slots=4096 hits=0 misses=1");
+
+      /* A truncated snapshot is loaded up to the last complete entry */
+      fst_requires(switch_loadable_module_unload_module((char *)"../.libs", (char *)"mod_phonenumber", SWITCH_FALSE, &err) == SWITCH_STATUS_SUCCESS);
+      fst_requires((fp = fopen(path, "rb")) != NULL);
+      fseek(fp, 0, SEEK_END);
+      size = ftell(fp);
+      fclose(fp);
+      fst_requires(truncate(path, size - 1) == 0);
+      fst_requires(switch_loadable_module_load_module((char *)"../.libs", (char *)"mod_phonenumber", SWITCH_FALSE, &err) == SWITCH_STATUS_SUCCESS);
+
+      PN_EXPECT("phonenumber", "cache stats", "+OK private slots=4096 ");
+
+      switch_safe_free(stream.data);
+    }
+    FST_TEST_END()
+
+    FST_TEST_BEGIN(guards)
+    {
+      switch_stream_handle_t stream = { 0 };
+
+      SWITCH_STANDARD_STREAM(stream);
+
+      switch_api_execute("phonenumber", "format,?valid,?type=MOBILE|FIXED_LINE_OR_MOBILE,get_region_code +16172531000", NULL, &stream);
+      fst_check_string_equals(stream.data, "+16172531000\nUS\n");
+      stream.end = stream.data;
+
+      switch_api_execute("phonenumber", "format,?valid,get_region_code +1617253100", NULL, &stream);
+      fst_check_string_equals(stream.data, "+1617253100\n");
+      stream.end = stream.data;
+
+      switch_api_execute("phonenumber", "format,?!valid,get_region_code +1617253100", NULL, &stream);
+      fst_check_string_equals(stream.data, "+1617253100\nZZ\n");
+      stream.end = stream.data;
+
+      switch_api_execute("phonenumber", "?region=GB|IE,format,get_number_type +442076792000", NULL, &stream);
+      fst_check_string_equals(stream.data, "+442076792000\nFIXED_LINE\n");
+      stream.end = stream.data;
+      *(char *)stream.data = '\0';
+
+      switch_api_execute("phonenumber", "?region=GB|IE,format +16172531000", NULL, &stream);
+      fst_check_string_equals(stream.data, "");
+      stream.end = stream.data;
+
+      switch_api_execute("phonenumber", "?type=MOBILE,format,get_number_type +447400123456", NULL, &stream);
+      fst_check_string_equals(stream.data, "+447400123456\nMOBILE\n");
+      stream.end = stream.data;
+
+      PN_EXPECT("phonenumber", "?bogus,format +16172531000", "-ERR");
+      PN_EXPECT("phonenumber", "?valid +16172531000", "-ERR");
+
+      switch_safe_free(stream.data);
+    }
+    FST_TEST_END()
+
+    FST_TEST_BEGIN(is_listed)
+    {
+      switch_stream_handle_t stream = { 0 };
+
+      SWITCH_STANDARD_STREAM(stream);
+
+      PN_EXPECT("phonenumber", "is_listed +16172531000", "true");
+      PN_EXPECT("phonenumber", "is_listed 6172531000 list=blocklist", "true");
+      PN_EXPECT("phonenumber", "is_listed '+44 20 7679 2000' list=blocklist", "true");
+      PN_EXPECT("phonenumber", "is_listed 0142685300 default_region=FR", "true");
+      PN_EXPECT("phonenumber", "is_listed +16172531001 list=blocklist", "false");
+      PN_EXPECT("phonenumber", "is_listed +16172531000 list=allowlist", "false");
+      PN_EXPECT("phonenumber", "is_listed anonymous", "-ERR");
+      PN_EXPECT("phonenumber", "list reload", "+OK 1 lists, 3 entries");
+      PN_EXPECT("phonenumber", "is_listed +16172531000", "true");
+      PN_EXPECT("phonenumber", "list bogus", "-ERR");
+
+      switch_safe_free(stream.data);
+    }
+    FST_TEST_END()
+
+    FST_TEST_BEGIN(profiles)
+    {
+      switch_core_session_t *session = NULL;
+      switch_call_cause_t cause = SWITCH_CAUSE_NONE;
+      switch_channel_t *channel;
+      switch_stream_handle_t stream = { 0 };
+
+      SWITCH_STANDARD_STREAM(stream);
+
+      PN_EXPECT("phonenumber", "format 02076792000 profile=uk", "020 7679 2000");
+      PN_EXPECT("phonenumber", "format 02076792000 format=E164,profile=uk", "+442076792000");
+      PN_EXPECT("phonenumber", "format 02076792000 profile=bogus", "-ERR");
+
+      fst_requires_module("mod_loopback");
+
+      fst_requires(switch_ivr_originate(NULL, &session, &cause, "{phonenumber_profile=uk}loopback/02076792000/load", 10, NULL, NULL, NULL, NULL, NULL, SOF_NONE,
+                                        NULL, NULL) == SWITCH_STATUS_SUCCESS);
+      channel = switch_core_session_get_channel(session);
+
+      switch_core_session_execute_application(session, "phonenumber", "get_region_code destination");
+      fst_check_string_equals(switch_channel_get_variable(channel, "phonenumber_destination_region_code"), "GB");
+
+      switch_channel_hangup(channel, SWITCH_CAUSE_NORMAL_CLEARING);
+      switch_core_session_rwunlock(session);
+      switch_safe_free(stream.data);
+    }
+    FST_TEST_END()
+
+    FST_TEST_BEGIN(async)
+    {
+      switch_stream_handle_t stream = { 0 };
+      int i;
+
+      SWITCH_STANDARD_STREAM(stream);
+
+      fst_requires(switch_event_bind("test_phonenumber", SWITCH_EVENT_CUSTOM, "phonenumber::result", async_result_handler, NULL) == SWITCH_STATUS_SUCCESS);
+
+      PN_EXPECT("phonenumber", "async get_region_code,format +442076792000 format=NATIONAL", "+OK ");
+
+      for (i = 0; i < 50 && !async_result[0]; i++) {
+        switch_yield(100000);
+      }
+
+      fst_check_string_equals(async_result, "GB\n020 7679 2000\n");
+
+      PN_EXPECT("phonenumber", "async format", "-ERR");
+
+      switch_event_unbind_callback(async_result_handler);
+      switch_safe_free(stream.data);
+    }
+    FST_TEST_END()
+
+    FST_TEST_BEGIN(top)
+    {
+      switch_stream_handle_t stream = { 0 };
+
+      SWITCH_STANDARD_STREAM(stream);
+
+      PN_EXPECT("phonenumber", "top reset", "+OK");
+      PN_EXPECT("phonenumber", "top caller 5", "");
+      PN_EXPECT("phonenumber", "top destination", "");
+
+      switch_safe_free(stream.data);
+    }
+    FST_TEST_END()
+
     FST_TEARDOWN_BEGIN()
     {
     }
@@ -0,0 +1,225 @@
+/*
+ * Copyright (c) 2019 Ciprian Dosoftei
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <test/switch_test.h>
+
+#include <inttypes.h>
+
+/**
+ * Benchmark workload (also the PGO training run, see "make pgo")
+ *
+ * Replays corpus/numbers.txt through the API (PN_BENCH_ROUNDS times, with a
+ * representative mix of actions and configurations), through the CS_INIT
+ * hooks (one loopback call per corpus line, at most PN_BENCH_CALLS) and
+ * through the chat application (one message per corpus line). The elapsed
+ * time is logged and, when PN_BENCH_OUTPUT is set in the environment,
+ * written to that file as "<microseconds> <operations>".
+ */
+#define PN_BENCH_CORPUS "corpus/numbers.txt"
+#define PN_BENCH_ROUNDS 5
+#define PN_BENCH_CALLS 512
+#define PN_BENCH_MAX_LINES 4096
+#define PN_BENCH_NUMBER_LEN 64
+
+struct pn_bench_line {
+  char caller[PN_BENCH_NUMBER_LEN];
+  char destination[PN_BENCH_NUMBER_LEN];
+};
+
+static struct pn_bench_line pn_bench_lines[PN_BENCH_MAX_LINES];
+static uint32_t pn_bench_count = 0;
+
+static const char *pn_bench_api[] = {
+  "format,get_region_code,get_number_type %s default_region=US",
+  "?valid,format,get_description_for_number %s default_region=US",
+  "is_possible_number,format %s default_region=GB,format=INTERNATIONAL",
+  "format_out_of_country_calling_number,get_national_significant_number %s calling_from=GB",
+  "normalize_digits_only,is_alpha_number %s",
+};
+
+static int pn_bench_load(const char *path)
+{
+  FILE *fp = fopen(path, "r");
+  char line[256];
+
+  if (!fp) {
+    return 0;
+  }
+
+  while (fgets(line, sizeof(line), fp) && (pn_bench_count < PN_BENCH_MAX_LINES)) {
+    struct pn_bench_line *entry = &pn_bench_lines[pn_bench_count];
+
+    if ((line[0] == '#') || (sscanf(line, "%63s %63s", entry->caller, entry->destination) != 2)) {
+      continue;
+    }
+
+    if (!strcmp(entry->caller, "-")) {
+      entry->caller[0] = '\0';
+    }
+
+    pn_bench_count++;
+  }
+
+  fclose(fp);
+
+  return pn_bench_count;
+}
+
+static void pn_bench_report(const char *label, switch_time_t elapsed, uint32_t operations)
+{
+  const char *output = getenv("PN_BENCH_OUTPUT");
+  FILE *fp;
+
+  switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_WARNING, "%s: %u operations in %" SWITCH_TIME_T_FMT "us (%.1f ops/s)\n", label, operations, elapsed,
+                    elapsed ? (operations * 1000000.0) / elapsed : 0.0);
+
+  if (!zstr(output) && (fp = fopen(output, "a"))) {
+    fprintf(fp, "%" SWITCH_TIME_T_FMT " %u %s\n", elapsed, operations, label);
+    fclose(fp);
+  }
+}
+
+FST_CORE_BEGIN("conf")
+{
+  FST_MODULE_BEGIN(mod_phonenumber, mod_phonenumber_bench)
+  {
+    FST_SETUP_BEGIN()
+    {
+      int level = SWITCH_LOG_WARNING;
+
+      fst_requires_module("mod_loopback");
+      fst_requires_module("mod_dptools");
+      fst_requires_module("mod_phonenumber");
+      fst_requires(pn_bench_load(PN_BENCH_CORPUS) > 0);
+
+      /* Keep the console logger off the measured (and profiled) path */
+      switch_core_session_ctl(SCSC_LOGLEVEL, &level);
+    }
+    FST_SETUP_END()
+
+    FST_TEST_BEGIN(api)
+    {
+      switch_stream_handle_t stream = { 0 };
+      switch_time_t started;
+      uint32_t i, j, round, operations = 0;
+      char args[256];
+
+      SWITCH_STANDARD_STREAM(stream);
+
+      started = switch_time_now();
+
+      for (round = 0; round < PN_BENCH_ROUNDS; round++) {
+        for (i = 0; i < pn_bench_count; i++) {
+          for (j = 0; j < sizeof(pn_bench_api) / sizeof(pn_bench_api[0]); j++) {
+            if (!zstr(pn_bench_lines[i].caller)) {
+              snprintf(args, sizeof(args), pn_bench_api[j], pn_bench_lines[i].caller);
+              switch_api_execute("phonenumber", args, NULL, &stream);
+              stream.end = stream.data;
+              operations++;
+            }
+
+            snprintf(args, sizeof(args), pn_bench_api[j], pn_bench_lines[i].destination);
+            switch_api_execute("phonenumber", args, NULL, &stream);
+            stream.end = stream.data;
+            operations++;
+          }
+        }
+      }
+
+      pn_bench_report("api", switch_time_now() - started, operations);
+      fst_check(operations > 0);
+
+      switch_safe_free(stream.data);
+    }
+    FST_TEST_END()
+
+    FST_TEST_BEGIN(hooks)
+    {
+      switch_time_t started, elapsed;
+      uint32_t i, originated = 0;
+      char dialstring[256];
+
+      started = switch_time_now();
+
+      for (i = 0; (i < pn_bench_count) && (i < PN_BENCH_CALLS); i++) {
+        switch_core_session_t *session = NULL;
+        switch_call_cause_t cause = SWITCH_CAUSE_NONE;
+
+        snprintf(dialstring, sizeof(dialstring), "{origination_caller_id_number=%s}loopback/%s/load", pn_bench_lines[i].caller, pn_bench_lines[i].destination);
+
+        if (switch_ivr_originate(NULL, &session, &cause, dialstring, 10, NULL, NULL, NULL, NULL, NULL, SOF_NONE, NULL, NULL) == SWITCH_STATUS_SUCCESS) {
+          switch_channel_hangup(switch_core_session_get_channel(session), SWITCH_CAUSE_NORMAL_CLEARING);
+          switch_core_session_rwunlock(session);
+          originated++;
+        }
+      }
+
+      /* The hooks have run by the time originate returns, teardown is not timed */
+      elapsed = switch_time_now() - started;
+
+      for (i = 0; (i < 100) && switch_core_session_count(); i++) {
+        switch_yield(100000);
+      }
+
+      pn_bench_report("hooks", elapsed, originated);
+      fst_check(originated > 0);
+    }
+    FST_TEST_END()
+
+    FST_TEST_BEGIN(chat)
+    {
+      switch_time_t started;
+      uint32_t i, round, delivered = 0;
+      char address[256];
+
+      started = switch_time_now();
+
+      for (round = 0; round < PN_BENCH_ROUNDS; round++) {
+        for (i = 0; i < pn_bench_count; i++) {
+          switch_event_t *message = NULL;
+
+          if (switch_event_create(&message, SWITCH_EVENT_MESSAGE) != SWITCH_STATUS_SUCCESS) {
+            continue;
+          }
+
+          snprintf(address, sizeof(address), "%s@sms.example.com", zstr(pn_bench_lines[i].caller) ? "anonymous" : pn_bench_lines[i].caller);
+          switch_event_add_header_string(message, SWITCH_STACK_BOTTOM, "from", address);
+          snprintf(address, sizeof(address), "%s@sms.example.com", pn_bench_lines[i].destination);
+          switch_event_add_header_string(message, SWITCH_STACK_BOTTOM, "to", address);
+          switch_event_add_header_string(message, SWITCH_STACK_BOTTOM, "to_user", pn_bench_lines[i].destination);
+
+          if (switch_core_execute_chat_app(message, "phonenumber", "default_region=US") == SWITCH_STATUS_SUCCESS) {
+            delivered++;
+          }
+
+          switch_event_destroy(&message);
+        }
+      }
+
+      pn_bench_report("chat", switch_time_now() - started, delivered);
+      fst_check(delivered > 0);
+    }
+    FST_TEST_END()
+  }
+  FST_MODULE_END()
+}
+FST_CORE_END()
@@ -0,0 +1,500 @@
+/*
+ * Copyright (c) 2019 Ciprian Dosoftei
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <test/switch_test.h>
+
+#include <inttypes.h>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "phonenumbers/geocoding/phonenumber_offline_geocoder.h"
+#include "phonenumbers/phonenumbermatch.h"
+#include "phonenumbers/phonenumbermatcher.h"
+#include "phonenumbers/phonenumberutil.h"
+
+using namespace std;
+
+using i18n::phonenumbers::PhoneNumber;
+using i18n::phonenumbers::PhoneNumberMatch;
+using i18n::phonenumbers::PhoneNumberMatcher;
+using i18n::phonenumbers::PhoneNumberOfflineGeocoder;
+using i18n::phonenumbers::PhoneNumberUtil;
+
+/**
+ * Golden corpus differential test
+ *
+ * Builds a corpus out of libphonenumber's example numbers (every region and
+ * non-geographical entity, every supported type) and a set of mutations of
+ * each of them, then runs every action through the module's API and through
+ * a reference implementation calling PhoneNumberUtil directly. Any output
+ * difference is a failure; the relative cost of both paths is logged.
+ */
+#define PN_GOLDEN_MAX_REPORTED 50
+
+static const PhoneNumberUtil &phone_util = *PhoneNumberUtil::GetInstance();
+
+struct pn_golden_case {
+  string input;
+  string region;
+  bool primary;
+};
+
+struct pn_golden_stats {
+  uint64_t count;
+  uint64_t mismatches;
+  switch_time_t module_us;
+  switch_time_t reference_us;
+};
+
+typedef string (*pn_golden_reference_t)(const pn_golden_case &c, const char *format);
+
+static const char *pn_golden_type_to_str(PhoneNumberUtil::PhoneNumberType type)
+{
+  switch (type) {
+  case PhoneNumberUtil::FIXED_LINE:
+    return "FIXED_LINE";
+  case PhoneNumberUtil::FIXED_LINE_OR_MOBILE:
+    return "FIXED_LINE_OR_MOBILE";
+  case PhoneNumberUtil::MOBILE:
+    return "MOBILE";
+  case PhoneNumberUtil::PAGER:
+    return "PAGER";
+  case PhoneNumberUtil::PERSONAL_NUMBER:
+    return "PERSONAL_NUMBER";
+  case PhoneNumberUtil::PREMIUM_RATE:
+    return "PREMIUM_RATE";
+  case PhoneNumberUtil::SHARED_COST:
+    return "SHARED_COST";
+  case PhoneNumberUtil::TOLL_FREE:
+    return "TOLL_FREE";
+  case PhoneNumberUtil::UAN:
+    return "UAN";
+  case PhoneNumberUtil::VOICEMAIL:
+    return "VOICEMAIL";
+  case PhoneNumberUtil::VOIP:
+    return "VOIP";
+  default:
+    return "UNKNOWN";
+  }
+}
+
+static PhoneNumberUtil::PhoneNumberFormat pn_golden_format(const char *format)
+{
+  if (!strcmp(format, "INTERNATIONAL")) {
+    return PhoneNumberUtil::INTERNATIONAL;
+  } else if (!strcmp(format, "NATIONAL")) {
+    return PhoneNumberUtil::NATIONAL;
+  } else if (!strcmp(format, "RFC3966")) {
+    return PhoneNumberUtil::RFC3966;
+  }
+
+  return PhoneNumberUtil::E164;
+}
+
+static PhoneNumber pn_golden_parse(const pn_golden_case &c)
+{
+  PhoneNumber number;
+
+  phone_util.Parse(c.input, c.region, &number);
+
+  return number;
+}
+
+static bool pn_golden_parses(const pn_golden_case &c)
+{
+  PhoneNumber number;
+
+  return phone_util.Parse(c.input, c.region, &number) == PhoneNumberUtil::NO_PARSING_ERROR;
+}
+
+static string pn_golden_is_alpha_number(const pn_golden_case &c, const char *format)
+{
+  return phone_util.IsAlphaNumber(c.input) ? "true" : "false";
+}
+
+static string pn_golden_convert_alpha_characters_in_number(const pn_golden_case &c, const char *format)
+{
+  string out = c.input;
+
+  phone_util.ConvertAlphaCharactersInNumber(&out);
+
+  return out;
+}
+
+static string pn_golden_normalize_digits_only(const pn_golden_case &c, const char *format)
+{
+  string out = c.input;
+
+  phone_util.NormalizeDigitsOnly(&out);
+
+  return out;
+}
+
+static string pn_golden_normalize_diallable_chars_only(const pn_golden_case &c, const char *format)
+{
+  string out = c.input;
+
+  phone_util.NormalizeDiallableCharsOnly(&out);
+
+  return out;
+}
+
+static string pn_golden_get_national_significant_number(const pn_golden_case &c, const char *format)
+{
+  string out;
+
+  phone_util.GetNationalSignificantNumber(pn_golden_parse(c), &out);
+
+  return out;
+}
+
+static string pn_golden_format_out_of_country_calling_number(const pn_golden_case &c, const char *format)
+{
+  string out;
+
+  phone_util.FormatOutOfCountryCallingNumber(pn_golden_parse(c), "GB", &out);
+
+  return out;
+}
+
+static string pn_golden_format(const pn_golden_case &c, const char *format)
+{
+  string out;
+
+  phone_util.Format(pn_golden_parse(c), pn_golden_format(format), &out);
+
+  return out;
+}
+
+static string pn_golden_get_number_type(const pn_golden_case &c, const char *format)
+{
+  return pn_golden_type_to_str(phone_util.GetNumberType(pn_golden_parse(c)));
+}
+
+static string pn_golden_is_valid_number_for_region(const pn_golden_case &c, const char *format)
+{
+  return phone_util.IsValidNumberForRegion(pn_golden_parse(c), c.region) ? "true" : "false";
+}
+
+static string pn_golden_get_region_code(const pn_golden_case &c, const char *format)
+{
+  string out;
+
+  phone_util.GetRegionCodeForNumber(pn_golden_parse(c), &out);
+
+  return out;
+}
+
+static string pn_golden_is_possible_number_with_reason(const pn_golden_case &c, const char *format)
+{
+  switch (phone_util.IsPossibleNumberWithReason(pn_golden_parse(c))) {
+  case PhoneNumberUtil::IS_POSSIBLE:
+    return "IS_POSSIBLE";
+  case PhoneNumberUtil::INVALID_COUNTRY_CODE:
+    return "INVALID_COUNTRY_CODE";
+  case PhoneNumberUtil::TOO_SHORT:
+    return "TOO_SHORT";
+  case PhoneNumberUtil::TOO_LONG:
+    return "TOO_LONG";
+  default:
+    return "UNKNOWN";
+  }
+}
+
+static string pn_golden_is_possible_number(const pn_golden_case &c, const char *format)
+{
+  return phone_util.IsPossibleNumber(pn_golden_parse(c)) ? "true" : "false";
+}
+
+static string pn_golden_is_valid_number(const pn_golden_case &c, const char *format)
+{
+  return phone_util.IsValidNumber(pn_golden_parse(c)) ? "true" : "false";
+}
+
+static string pn_golden_get_description_for_number(const pn_golden_case &c, const char *format)
+{
+  return PhoneNumberOfflineGeocoder().GetDescriptionForNumber(pn_golden_parse(c), icu::Locale("en_US"));
+}
+
+static string pn_golden_extract(const pn_golden_case &c, const char *format)
+{
+  string text = "Call " + c.input + " now", out, formatted;
+  PhoneNumberMatcher matcher(text, c.region);
+  PhoneNumberMatch match;
+  char span[32];
+
+  while (matcher.HasNext()) {
+    matcher.Next(&match);
+    phone_util.Format(match.number(), PhoneNumberUtil::E164, &formatted);
+    snprintf(span, sizeof(span), "%d-%d", match.start(), match.end());
+    out += string(span) + " " + formatted + "\n";
+  }
+
+  return out.empty() ? out : out.substr(0, out.length() - 1);
+}
+
+struct pn_golden_action {
+  const char *name;
+  pn_golden_reference_t reference;
+  bool primary_only;
+  bool text;
+  bool parse;
+};
+
+static const pn_golden_action pn_golden_actions[] = {
+  { "is_alpha_number", pn_golden_is_alpha_number, false, false, false },
+  { "convert_alpha_characters_in_number", pn_golden_convert_alpha_characters_in_number, false, false, false },
+  { "normalize_digits_only", pn_golden_normalize_digits_only, false, false, false },
+  { "normalize_diallable_chars_only", pn_golden_normalize_diallable_chars_only, false, false, false },
+  { "get_national_significant_number", pn_golden_get_national_significant_number, false, false, true },
+  { "format_out_of_country_calling_number", pn_golden_format_out_of_country_calling_number, false, false, true },
+  { "format", pn_golden_format, false, false, true },
+  { "get_number_type", pn_golden_get_number_type, false, false, true },
+  { "is_valid_number_for_region", pn_golden_is_valid_number_for_region, false, false, true },
+  { "get_region_code", pn_golden_get_region_code, false, false, true },
+  { "is_possible_number_with_reason", pn_golden_is_possible_number_with_reason, false, false, true },
+  { "is_possible_number", pn_golden_is_possible_number, false, false, true },
+  { "is_valid_number", pn_golden_is_valid_number, false, false, true },
+  { "get_description_for_number", pn_golden_get_description_for_number, true, false, true },
+  { "extract", pn_golden_extract, true, true, false },
+};
+
+static const char *pn_golden_formats[] = { "E164", "INTERNATIONAL", "NATIONAL", "RFC3966" };
+
+/**
+ * Rewrites ASCII digits as their counterparts in another Unicode block
+ * (e.g. full-width or Arabic-Indic digits), given the UTF-8 encoding of the
+ * block's zero split into its leading bytes and its last byte.
+ */
+static string pn_golden_unicode_digits(const string &in, const char *lead, unsigned char zero)
+{
+  string out;
+
+  for (size_t i = 0; i < in.length(); i++) {
+    if ((in[i] >= '0') && (in[i] <= '9')) {
+      out += lead;
+      out += (char)(zero + (in[i] - '0'));
+    } else {
+      out += in[i];
+    }
+  }
+
+  return out;
+}
+
+static string pn_golden_replace(const string &in, char from, const char *to)
+{
+  string out;
+
+  for (size_t i = 0; i < in.length(); i++) {
+    if (in[i] == from) {
+      out += to;
+    } else {
+      out += in[i];
+    }
+  }
+
+  return out;
+}
+
+static string pn_golden_alpha(const string &in)
+{
+  static const char *keypad = "??ADGJMPTW";
+  string out = in;
+  size_t i, converted = 0;
+
+  for (i = out.length(); i > 0 && converted < 4; i--) {
+    char c = out[i - 1];
+
+    if ((c >= '2') && (c <= '9')) {
+      out[i - 1] = keypad[c - '0'];
+      converted++;
+    }
+  }
+
+  return out;
+}
+
+static void pn_golden_add_number(vector<pn_golden_case> &corpus, const PhoneNumber &number, const string &region)
+{
+  string e164, international, national, nsn;
+  char cc[8];
+
+  phone_util.Format(number, PhoneNumberUtil::E164, &e164);
+  phone_util.Format(number, PhoneNumberUtil::INTERNATIONAL, &international);
+  phone_util.Format(number, PhoneNumberUtil::NATIONAL, &national);
+  phone_util.GetNationalSignificantNumber(number, &nsn);
+  snprintf(cc, sizeof(cc), "%d", number.country_code());
+
+  corpus.push_back({ e164, region, true });
+  corpus.push_back({ international, region, false });
+  corpus.push_back({ national, region, false });
+  corpus.push_back({ pn_golden_replace(international, ' ', "-"), region, false });
+  corpus.push_back({ pn_golden_replace(national, ' ', "."), region, false });
+  corpus.push_back({ pn_golden_replace(national, ' ', ""), region, false });
+  corpus.push_back({ "00" + string(cc) + nsn, region, false });
+  corpus.push_back({ pn_golden_alpha(national), region, false });
+  corpus.push_back({ pn_golden_unicode_digits(e164, "\xEF\xBC", 0x90), region, false });
+  corpus.push_back({ pn_golden_unicode_digits(national, "\xD9", 0xA0), region, false });
+  corpus.push_back({ e164, "ZZ", false });
+  corpus.push_back({ national, "US", false });
+}
+
+static void pn_golden_build(vector<pn_golden_case> &corpus)
+{
+  set<string> regions;
+  set<int> codes;
+  PhoneNumber number;
+  string region;
+
+  phone_util.GetSupportedRegions(&regions);
+
+  for (set<string>::const_iterator it = regions.begin(); it != regions.end(); ++it) {
+    set<PhoneNumberUtil::PhoneNumberType> types;
+
+    phone_util.GetSupportedTypesForRegion(*it, &types);
+
+    for (set<PhoneNumberUtil::PhoneNumberType>::const_iterator type = types.begin(); type != types.end(); ++type) {
+      if (phone_util.GetExampleNumberForType(*it, *type, &number)) {
+        pn_golden_add_number(corpus, number, *it);
+      }
+    }
+  }
+
+  phone_util.GetSupportedGlobalNetworkCallingCodes(&codes);
+
+  for (set<int>::const_iterator it = codes.begin(); it != codes.end(); ++it) {
+    if (phone_util.GetExampleNumberForNonGeoEntity(*it, &number)) {
+      pn_golden_add_number(corpus, number, "US");
+    }
+  }
+}
+
+static string pn_golden_module(switch_stream_handle_t *stream, const string &action, const string &input, const string &config)
+{
+  string args = action + " '" + input + "' " + config, out;
+
+  stream->end = stream->data;
+  *(char *)stream->data = '\0';
+  switch_api_execute("phonenumber", args.c_str(), NULL, stream);
+
+  out = stream->data ? (char *)stream->data : "";
+  while (!out.empty() && (out[out.length() - 1] == '\n')) {
+    out.erase(out.length() - 1);
+  }
+
+  return out;
+}
+
+FST_CORE_BEGIN("conf")
+{
+  FST_MODULE_BEGIN(mod_phonenumber, mod_phonenumber_golden_test)
+  {
+    FST_SETUP_BEGIN()
+    {
+      fst_requires_module("mod_phonenumber");
+    }
+    FST_SETUP_END()
+
+    FST_TEST_BEGIN(differential)
+    {
+      switch_stream_handle_t stream = { 0 };
+      vector<pn_golden_case> corpus;
+      uint64_t mismatches = 0, reported = 0;
+      size_t a, f, i;
+
+      SWITCH_STANDARD_STREAM(stream);
+      pn_golden_build(corpus);
+
+      switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "Golden corpus: %zu inputs\n", corpus.size());
+      fst_check(corpus.size() > 1000);
+
+      for (a = 0; a < sizeof(pn_golden_actions) / sizeof(pn_golden_actions[0]); a++) {
+        const pn_golden_action *action = &pn_golden_actions[a];
+        size_t formats = strcmp(action->name, "format") ? 1 : sizeof(pn_golden_formats) / sizeof(pn_golden_formats[0]);
+
+        for (f = 0; f < formats; f++) {
+          pn_golden_stats stats = { 0, 0, 0, 0 };
+          string config;
+
+          for (i = 0; i < corpus.size(); i++) {
+            const pn_golden_case &c = corpus[i];
+            string expected, actual, input = c.input;
+            switch_time_t started;
+            bool matched;
+
+            if (action->primary_only && !c.primary) {
+              continue;
+            }
+
+            config = "default_region=" + c.region + ",calling_from=GB,format=" + pn_golden_formats[f];
+
+            started = switch_time_now();
+            actual = pn_golden_module(&stream, action->name, action->text ? ("Call " + input + " now") : input, config);
+            stats.module_us += switch_time_now() - started;
+
+            started = switch_time_now();
+            if (action->parse && !pn_golden_parses(c)) {
+              /* Unparseable inputs short-circuit to an -ERR line, whatever the reason */
+              expected = "-ERR ";
+              matched = !actual.compare(0, expected.length(), expected);
+            } else {
+              expected = action->reference(c, pn_golden_formats[f]);
+              matched = (actual == expected);
+            }
+            stats.reference_us += switch_time_now() - started;
+
+            stats.count++;
+
+            if (!matched) {
+              stats.mismatches++;
+
+              if (reported++ < PN_GOLDEN_MAX_REPORTED) {
+                switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_ERROR, "Mismatch: %s '%s' %s => '%s', expected '%s'\n", action->name, input.c_str(), config.c_str(),
+                                  actual.c_str(), expected.c_str());
+              }
+            }
+          }
+
+          mismatches += stats.mismatches;
+
+          switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "%-36s %-13s %7" PRIu64 " cases, %" PRIu64 " mismatches, module/reference time ratio %.2f\n", action->name,
+                            formats > 1 ? pn_golden_formats[f] : "", stats.count, stats.mismatches,
+                            stats.reference_us ? (double)stats.module_us / (double)stats.reference_us : 0.0);
+        }
+      }
+
+      fst_check(mismatches == 0);
+
+      switch_safe_free(stream.data);
+    }
+    FST_TEST_END()
+
+    FST_TEARDOWN_BEGIN()
+    {
+    }
+    FST_TEARDOWN_END()
+  }
+  FST_MODULE_END()
+}
+FST_CORE_END()
@@ -0,0 +1,185 @@
+/*
+ * Copyright (c) 2019 Ciprian Dosoftei
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <test/switch_test.h>
+
+/**
+ * Load profile: every thread originates PN_LOAD_CHANNELS loopback calls
+ * (i.e. two channels each, both going through the CS_INIT hooks).
+ */
+#define PN_LOAD_THREADS 16
+#define PN_LOAD_CHANNELS 128
+#define PN_LOAD_DIALSTRING "{origination_caller_id_number=+442076792000}loopback/+16172531000/load"
+#define PN_LOAD_MAX_P99_US 50000
+#define PN_LOAD_MAX_SAMPLES 4096
+
+static switch_mutex_t *pn_load_mutex = NULL;
+static uint32_t pn_load_channels = 0;
+static uint32_t pn_load_missing = 0;
+static uint32_t pn_load_originated = 0;
+static uint32_t pn_load_failed = 0;
+
+static int pn_load_compare(const void *a, const void *b)
+{
+  uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+  return (x > y) - (x < y);
+}
+
+/**
+ * Runs after mod_phonenumber's own CS_INIT handler (it is installed later),
+ * so every variable the hook is expected to set must be present by now.
+ */
+static switch_status_t pn_load_on_init(switch_core_session_t *session)
+{
+  switch_channel_t *channel = switch_core_session_get_channel(session);
+  const char *format = switch_channel_get_variable(channel, "phonenumber_destination_format");
+  const char *region = switch_channel_get_variable(channel, "phonenumber_destination_region_code");
+  const char *type = switch_channel_get_variable(channel, "phonenumber_destination_number_type");
+  const char *caller = switch_channel_get_variable(channel, "phonenumber_caller_input");
+  int missing = 0;
+
+  if (zstr(format) || strcmp(format, "+16172531000") || zstr(region) || strcmp(region, "US") || zstr(type) || zstr(caller)) {
+    switch_log_printf(SWITCH_CHANNEL_SESSION_LOG(session), SWITCH_LOG_ERROR, "Missing hook variables on %s\n", switch_channel_get_name(channel));
+    missing = 1;
+  }
+
+  switch_mutex_lock(pn_load_mutex);
+  pn_load_channels++;
+  pn_load_missing += missing;
+  switch_mutex_unlock(pn_load_mutex);
+
+  return SWITCH_STATUS_SUCCESS;
+}
+
+static switch_state_handler_table_t pn_load_state_handlers = {
+  /*.on_init */ pn_load_on_init,
+};
+
+static void *SWITCH_THREAD_FUNC pn_load_thread(switch_thread_t *thread, void *obj)
+{
+  int i;
+
+  for (i = 0; i < PN_LOAD_CHANNELS; i++) {
+    switch_core_session_t *session = NULL;
+    switch_call_cause_t cause = SWITCH_CAUSE_NONE;
+
+    if (switch_ivr_originate(NULL, &session, &cause, PN_LOAD_DIALSTRING, 10, NULL, NULL, NULL, NULL, NULL, SOF_NONE, NULL, NULL) == SWITCH_STATUS_SUCCESS) {
+      switch_channel_hangup(switch_core_session_get_channel(session), SWITCH_CAUSE_NORMAL_CLEARING);
+      switch_core_session_rwunlock(session);
+
+      switch_mutex_lock(pn_load_mutex);
+      pn_load_originated++;
+      switch_mutex_unlock(pn_load_mutex);
+    } else {
+      switch_mutex_lock(pn_load_mutex);
+      pn_load_failed++;
+      switch_mutex_unlock(pn_load_mutex);
+    }
+  }
+
+  return NULL;
+}
+
+FST_CORE_BEGIN("conf")
+{
+  FST_MODULE_BEGIN(mod_phonenumber, mod_phonenumber_load_test)
+  {
+    FST_SETUP_BEGIN()
+    {
+      fst_requires_module("mod_loopback");
+      fst_requires_module("mod_dptools");
+      fst_requires_module("mod_phonenumber");
+      switch_mutex_init(&pn_load_mutex, SWITCH_MUTEX_NESTED, fst_pool);
+      switch_core_add_state_handler(&pn_load_state_handlers);
+    }
+    FST_SETUP_END()
+
+    FST_TEST_BEGIN(concurrent_hooks)
+    {
+      switch_thread_t *threads[PN_LOAD_THREADS];
+      switch_threadattr_t *attr = NULL;
+      switch_stream_handle_t stream = { 0 };
+      switch_status_t status;
+      switch_time_t started, elapsed;
+      uint32_t samples[PN_LOAD_MAX_SAMPLES], count = 0;
+      char *line;
+      int i;
+
+      SWITCH_STANDARD_STREAM(stream);
+      switch_threadattr_create(&attr, fst_pool);
+      switch_threadattr_stacksize_set(attr, SWITCH_THREAD_STACKSIZE);
+
+      started = switch_time_now();
+
+      for (i = 0; i < PN_LOAD_THREADS; i++) {
+        switch_thread_create(&threads[i], attr, pn_load_thread, NULL, fst_pool);
+      }
+
+      for (i = 0; i < PN_LOAD_THREADS; i++) {
+        switch_thread_join(&status, threads[i]);
+      }
+
+      for (i = 0; (i < 100) && switch_core_session_count(); i++) {
+        switch_yield(100000);
+      }
+
+      elapsed = switch_time_now() - started;
+
+      switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "Originated %u calls (%u failed), %u channels initialized in %" SWITCH_TIME_T_FMT "ms (%.1f channels/s)\n",
+                        pn_load_originated, pn_load_failed, pn_load_channels, elapsed / 1000, elapsed ? (pn_load_channels * 1000000.0) / elapsed : 0.0);
+
+      fst_check_int_equals(pn_load_failed, 0);
+      fst_check_int_equals(pn_load_channels, pn_load_originated * 2);
+      fst_check_int_equals(pn_load_missing, 0);
+
+      /* Per lookup hook latency, as recorded by the trace ring buffer */
+      switch_api_execute("phonenumber", "trace dump", NULL, &stream);
+
+      for (line = (char *)stream.data; line && (line = strstr(line, " total=")) && (count < PN_LOAD_MAX_SAMPLES); line++) {
+        samples[count++] = (uint32_t)atoi(line + 7);
+      }
+
+      fst_check(count > 0);
+
+      if (count) {
+        qsort(samples, count, sizeof(uint32_t), pn_load_compare);
+
+        switch_log_printf(SWITCH_CHANNEL_LOG, SWITCH_LOG_INFO, "Hook latency over %u lookups: p50=%uus p90=%uus p99=%uus max=%uus\n", count,
+                          samples[count / 2], samples[(count * 9) / 10], samples[(count * 99) / 100], samples[count - 1]);
+
+        fst_check(samples[(count * 99) / 100] < PN_LOAD_MAX_P99_US);
+      }
+
+      switch_safe_free(stream.data);
+    }
+    FST_TEST_END()
+
+    FST_TEARDOWN_BEGIN()
+    {
+      switch_core_remove_state_handler(&pn_load_state_handlers);
+    }
+    FST_TEARDOWN_END()
+  }
+  FST_MODULE_END()
+}
+FST_CORE_END()